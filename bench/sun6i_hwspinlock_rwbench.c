@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sun6i_hwspinlock_rwbench.c - read side scaling benchmark for the sun6i hwspinlock rw lock
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ */
+
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/errno.h>
+#include <linux/hwspinlock.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include "../sun6i_hwspinlock.h"
+
+#define DRIVER_NAME		"sun6i_hwspinlock_rwbench"
+
+#define GUARD_LOCK		0
+#define MAX_LOCKS		256
+#define DURATION		1000
+#define MIN_DURATION		10
+#define MAX_DURATION		60000
+#define HOLDTIME		1000
+#define MAX_HOLDTIME		1000000
+#define TIMEOUT			100 /* ms */
+
+static int guard_lock = GUARD_LOCK;
+module_param(guard_lock, int, 0444);
+MODULE_PARM_DESC(guard_lock, "hwlock used as guard (default: 0 (0..255))");
+static int max_cpus;
+module_param(max_cpus, int, 0444);
+MODULE_PARM_DESC(max_cpus, "scale readers up to this amount of cpus (default: 0 (all online cpus))");
+static int duration = DURATION;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "time period of every run in ms (default: 1000 (10..60000))");
+static int holdtime = HOLDTIME;
+module_param(holdtime, int, 0444);
+MODULE_PARM_DESC(holdtime, "time period spent in the critical section in ns (default: 1000 (0..1000000))");
+
+enum sun6i_hwspinlock_rwbench_mode {
+	RWBENCH_EXCLUSIVE,
+	RWBENCH_READ,
+};
+
+struct sun6i_hwspinlock_rwbench {
+	struct sun6i_hwspinlock_rwlock rw;
+	struct hwspinlock *guard;
+	enum sun6i_hwspinlock_rwbench_mode mode;
+	struct completion done;
+	atomic_t running;
+	atomic64_t ops;
+	atomic_t errors;
+	bool stop;
+};
+
+static int sun6i_hwspinlock_rwbench_worker(void *data)
+{
+	struct sun6i_hwspinlock_rwbench *bench = data;
+	u64 ops = 0;
+
+	while (!READ_ONCE(bench->stop)) {
+		if (bench->mode == RWBENCH_EXCLUSIVE) {
+			if (hwspin_lock_timeout(bench->guard, TIMEOUT)) {
+				atomic_inc(&bench->errors);
+				continue;
+			}
+			ndelay(holdtime);
+			hwspin_unlock(bench->guard);
+		} else {
+			if (sun6i_hwspin_read_lock(&bench->rw, TIMEOUT)) {
+				atomic_inc(&bench->errors);
+				continue;
+			}
+			ndelay(holdtime);
+			sun6i_hwspin_read_unlock(&bench->rw);
+		}
+
+		++ops;
+		cond_resched();
+	}
+
+	atomic64_add(ops, &bench->ops);
+	if (atomic_dec_and_test(&bench->running))
+		complete(&bench->done);
+
+	return 0;
+}
+
+/* returns the operations per second of ncpus workers or a negative error */
+static s64 sun6i_hwspinlock_rwbench_run(struct sun6i_hwspinlock_rwbench *bench, int ncpus,
+					enum sun6i_hwspinlock_rwbench_mode mode)
+{
+	struct task_struct *task;
+	int cpu, started = 0;
+
+	bench->mode = mode;
+	bench->stop = false;
+	atomic64_set(&bench->ops, 0);
+	atomic_set(&bench->running, ncpus);
+	reinit_completion(&bench->done);
+
+	for_each_online_cpu(cpu) {
+		if (started == ncpus)
+			break;
+
+		task = kthread_create(sun6i_hwspinlock_rwbench_worker, bench, "hwlock_rwbench/%d",
+				      cpu);
+		if (IS_ERR(task))
+			break;
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		++started;
+	}
+
+	/* account workers which could not be started */
+	for (cpu = started; cpu < ncpus; ++cpu) {
+		if (atomic_dec_and_test(&bench->running))
+			complete(&bench->done);
+	}
+
+	msleep(duration);
+	WRITE_ONCE(bench->stop, true);
+	wait_for_completion(&bench->done);
+
+	if (started != ncpus)
+		return -ECHILD;
+
+	return div_u64(atomic64_read(&bench->ops) * MSEC_PER_SEC, duration);
+}
+
+static int sun6i_hwspinlock_rwbench(void)
+{
+	struct sun6i_hwspinlock_rw_shared *shared;
+	struct sun6i_hwspinlock_rwbench *bench;
+	s64 exclusive, read;
+	int ncpus, err = 0;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	shared = kzalloc(sizeof(*shared), GFP_KERNEL);
+	if (!bench || !shared) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	bench->guard = hwspin_lock_request_specific(guard_lock);
+	if (!bench->guard) {
+		pr_info("[init] requesting guard lock %d failed\n", guard_lock);
+		err = -EIO;
+		goto out;
+	}
+
+	/* the state is only shared between the ARM cores here, no companion core involved */
+	sun6i_hwspin_rwlock_init(&bench->rw, bench->guard, shared);
+	init_completion(&bench->done);
+
+	pr_info("[run ]--- read side scaling, %d ms per run, %d ns hold time ---\n", duration,
+		holdtime);
+	for (ncpus = 1; ncpus <= max_cpus; ++ncpus) {
+		exclusive = sun6i_hwspinlock_rwbench_run(bench, ncpus, RWBENCH_EXCLUSIVE);
+		read = sun6i_hwspinlock_rwbench_run(bench, ncpus, RWBENCH_READ);
+		if (exclusive < 0 || read < 0) {
+			pr_info("[run ] starting %d workers failed\n", ncpus);
+			err = -ECHILD;
+			break;
+		}
+
+		pr_info("[run ] %d cpus: exclusive %lld ops/s, read %lld ops/s, ratio %lld.%02lld\n",
+			ncpus, exclusive, read, exclusive ? div64_s64(read, exclusive) : 0,
+			exclusive ? div64_s64(read * 100, exclusive) % 100 : 0);
+	}
+
+	if (atomic_read(&bench->errors)) {
+		pr_info("[run ] %d lock attempts timed out\n", atomic_read(&bench->errors));
+		err = -ETIMEDOUT;
+	}
+
+	hwspin_lock_free(bench->guard);
+
+out:
+	kfree(shared);
+	kfree(bench);
+
+	return err;
+}
+
+static int __init sun6i_hwspinlock_rwbench_init(void)
+{
+	pr_info("[init]--- SUN6I HWSPINLOCK RW LOCK BENCHMARK ---\n");
+
+	if (guard_lock < 0 || guard_lock > (MAX_LOCKS - 1))
+		guard_lock = GUARD_LOCK;
+
+	if (max_cpus < 1 || max_cpus > num_online_cpus())
+		max_cpus = num_online_cpus();
+
+	if (duration < MIN_DURATION || duration > MAX_DURATION)
+		duration = DURATION;
+
+	if (holdtime < 0 || holdtime > MAX_HOLDTIME)
+		holdtime = HOLDTIME;
+
+	return sun6i_hwspinlock_rwbench();
+}
+module_init(sun6i_hwspinlock_rwbench_init);
+
+static void __exit sun6i_hwspinlock_rwbench_exit(void)
+{
+	pr_info("[exit]--- SUN6I HWSPINLOCK RW LOCK BENCHMARK ---\n");
+}
+module_exit(sun6i_hwspinlock_rwbench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SUN6I hardware spinlock rw lock benchmark");
+MODULE_AUTHOR("Wilken Gottwalt <wilken.gottwalt@posteo.net>");
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sun6i_hwspinlock_emu.c - emulated sun6i hardware spinlock device
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * Registers platform devices for the sun6i_hwspinlock (or sun6i_hwspinlock_mod) driver and the
+ * sun6i_hwspinlock_test2 module, backed by a register page in normal memory plus dummy clock
+ * and reset providers, so the drivers and test modules can run on any Linux host.
+ */
+
+#include <linux/atomic.h>
+#include <linux/clk-provider.h>
+#include <linux/clkdev.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/io.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/reset-controller.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "../sun6i_hwspinlock_emu.h"
+
+#define DRIVER_NAME		"sun6i_hwspinlock_emu"
+
+#define SPINLOCK_SYSSTATUS_REG	0x0000
+#define SPINLOCK_STATUS_REG	0x0010
+#define SPINLOCK_LOCK_REGN	0x0100
+#define SPINLOCK_NOTTAKEN	0
+#define SPINLOCK_TAKEN		1
+#define SPINLOCK_PAGE_SIZE	0x1000
+
+#define LOCKS			32
+#define MIN_LOCKS		32
+#define MAX_LOCKS		256
+
+static int nlocks = LOCKS;
+module_param(nlocks, int, 0444);
+MODULE_PARM_DESC(nlocks, "amount of emulated hwlocks (default: 32 (32, 64, 128, 256))");
+static int variant;
+module_param(variant, int, 0444);
+MODULE_PARM_DESC(variant, "emulated driver variant, sun6i_hwspinlock or sun6i_hwspinlock_mod (default: 0 (0..1))");
+
+static const char * const sun6i_hwspinlock_emu_names[] = {
+	"sun6i_hwspinlock",
+	"sun6i_hwspinlock_mod",
+};
+
+struct sun6i_hwspinlock_emu_data {
+	struct sun6i_hwspinlock_emu emu;
+	u32 *page;
+	struct platform_device *provider;
+	struct platform_device *hwlock;
+	struct platform_device *stat;
+	struct reset_controller_dev rcdev;
+	struct clk_hw *clk;
+	struct clk_lookup *clk_lookup;
+};
+
+static struct sun6i_hwspinlock_emu_data *sun6i_hwspinlock_emu;
+
+/* returns the lock number of a lock register address or -1 for any other register */
+static int sun6i_hwspinlock_emu_lock(const struct sun6i_hwspinlock_emu *emu,
+				     void __iomem *addr)
+{
+	long offset = (char __iomem *)addr - (char __iomem *)emu->base - SPINLOCK_LOCK_REGN;
+
+	if (offset < 0 || offset >= (long)(nlocks * sizeof(u32)) || offset % sizeof(u32))
+		return -1;
+
+	return offset / sizeof(u32);
+}
+
+static atomic_t *sun6i_hwspinlock_emu_status(struct sun6i_hwspinlock_emu_data *priv)
+{
+	return (atomic_t *)&priv->page[SPINLOCK_STATUS_REG / sizeof(u32)];
+}
+
+/*
+ * a read of a free lock register takes the lock and returns 0, like the hardware does, every
+ * lock register is a test-and-set of its own, so emulated locks do not serialize each other
+ */
+static u32 sun6i_hwspinlock_emu_read(const struct sun6i_hwspinlock_emu *emu, void __iomem *addr)
+{
+	struct sun6i_hwspinlock_emu_data *priv = emu->priv;
+	int id = sun6i_hwspinlock_emu_lock(emu, addr);
+	u32 val;
+
+	if (id < 0)
+		return READ_ONCE(*(u32 *)(__force void *)addr);
+
+	val = xchg(&priv->page[SPINLOCK_LOCK_REGN / sizeof(u32) + id], SPINLOCK_TAKEN);
+	if (val == SPINLOCK_NOTTAKEN && id < 32)
+		atomic_or(BIT(id), sun6i_hwspinlock_emu_status(priv));
+
+	return val;
+}
+
+/*
+ * only writing 0 to a lock register has an effect, it releases the lock, the status bit is
+ * cleared first, so it can not clear the bit of the next holder
+ */
+static void sun6i_hwspinlock_emu_write(const struct sun6i_hwspinlock_emu *emu, u32 val,
+				       void __iomem *addr)
+{
+	struct sun6i_hwspinlock_emu_data *priv = emu->priv;
+	int id = sun6i_hwspinlock_emu_lock(emu, addr);
+
+	if (id < 0 || val != SPINLOCK_NOTTAKEN)
+		return;
+
+	if (id < 32)
+		atomic_andnot(BIT(id), sun6i_hwspinlock_emu_status(priv));
+	smp_store_release(&priv->page[SPINLOCK_LOCK_REGN / sizeof(u32) + id], SPINLOCK_NOTTAKEN);
+}
+
+static int sun6i_hwspinlock_emu_reset(struct reset_controller_dev *rcdev, unsigned long id)
+{
+	return 0;
+}
+
+static const struct reset_control_ops sun6i_hwspinlock_emu_reset_ops = {
+	.assert		= sun6i_hwspinlock_emu_reset,
+	.deassert	= sun6i_hwspinlock_emu_reset,
+};
+
+/*
+ * the reset core has no way to remove lookups again, so they are never freed, lookups left
+ * behind by an earlier load still match because the provider is registered with the same name
+ */
+static int sun6i_hwspinlock_emu_reset_lookup(void)
+{
+	struct reset_control_lookup *lookup;
+	int i;
+
+	lookup = kcalloc(ARRAY_SIZE(sun6i_hwspinlock_emu_names), sizeof(*lookup), GFP_KERNEL);
+	if (!lookup)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_hwspinlock_emu_names); ++i) {
+		lookup[i].provider = kstrdup(DRIVER_NAME, GFP_KERNEL);
+		lookup[i].dev_id = kstrdup(sun6i_hwspinlock_emu_names[i], GFP_KERNEL);
+		lookup[i].con_id = kstrdup("ahb", GFP_KERNEL);
+		if (!lookup[i].provider || !lookup[i].dev_id || !lookup[i].con_id)
+			goto fail;
+	}
+
+	reset_controller_add_lookup(lookup, ARRAY_SIZE(sun6i_hwspinlock_emu_names));
+
+	return 0;
+
+fail:
+	for (i = 0; i < ARRAY_SIZE(sun6i_hwspinlock_emu_names); ++i) {
+		kfree(lookup[i].provider);
+		kfree(lookup[i].dev_id);
+		kfree(lookup[i].con_id);
+	}
+	kfree(lookup);
+
+	return -ENOMEM;
+}
+
+static void sun6i_hwspinlock_emu_cleanup(struct sun6i_hwspinlock_emu_data *priv)
+{
+	platform_device_unregister(priv->stat);
+	platform_device_unregister(priv->hwlock);
+	if (priv->rcdev.dev)
+		reset_controller_unregister(&priv->rcdev);
+	if (priv->clk_lookup)
+		clkdev_drop(priv->clk_lookup);
+	if (!IS_ERR_OR_NULL(priv->clk))
+		clk_hw_unregister_fixed_rate(priv->clk);
+	platform_device_unregister(priv->provider);
+	kfree(priv->page);
+	kfree(priv);
+}
+
+static int __init sun6i_hwspinlock_emu_init(void)
+{
+	struct sun6i_hwspinlock_emu_data *priv;
+	const char *name;
+	int err;
+
+	pr_info("[init]--- SUN6I HWSPINLOCK EMULATION ---\n");
+
+	if (nlocks != 32 && nlocks != 64 && nlocks != 128 && nlocks != 256)
+		nlocks = LOCKS;
+	if (variant < 0 || variant >= ARRAY_SIZE(sun6i_hwspinlock_emu_names))
+		variant = 0;
+	name = sun6i_hwspinlock_emu_names[variant];
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	priv->page = kzalloc(SPINLOCK_PAGE_SIZE, GFP_KERNEL);
+	if (!priv->page) {
+		kfree(priv);
+		return -ENOMEM;
+	}
+
+	/* same encoding as the hardware, 0x1 to 0x4 in bit 28 and up represent 32 to 256 locks */
+	priv->page[SPINLOCK_SYSSTATUS_REG / sizeof(u32)] = (ilog2(nlocks) - 4) << 28;
+	priv->emu.base = (void __iomem __force *)priv->page;
+	priv->emu.read = sun6i_hwspinlock_emu_read;
+	priv->emu.write = sun6i_hwspinlock_emu_write;
+	priv->emu.priv = priv;
+
+	priv->provider = platform_device_register_simple(DRIVER_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(priv->provider)) {
+		err = PTR_ERR(priv->provider);
+		priv->provider = NULL;
+		goto fail;
+	}
+
+	priv->clk = clk_hw_register_fixed_rate(&priv->provider->dev, "sun6i-hwspinlock-emu-ahb",
+					       NULL, 0, 24000000);
+	if (IS_ERR(priv->clk)) {
+		err = PTR_ERR(priv->clk);
+		goto fail;
+	}
+
+	priv->clk_lookup = clkdev_hw_create(priv->clk, "ahb", "%s", name);
+	if (!priv->clk_lookup) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	err = sun6i_hwspinlock_emu_reset_lookup();
+	if (err)
+		goto fail;
+
+	priv->rcdev.ops = &sun6i_hwspinlock_emu_reset_ops;
+	priv->rcdev.owner = THIS_MODULE;
+	priv->rcdev.nr_resets = 1;
+	priv->rcdev.dev = &priv->provider->dev;
+	err = reset_controller_register(&priv->rcdev);
+	if (err) {
+		priv->rcdev.dev = NULL;
+		goto fail;
+	}
+
+	/* the devices are named like their drivers, so they bind without device tree */
+	priv->hwlock = platform_device_register_data(&priv->provider->dev, name,
+						     PLATFORM_DEVID_NONE, &priv->emu,
+						     sizeof(priv->emu));
+	if (IS_ERR(priv->hwlock)) {
+		err = PTR_ERR(priv->hwlock);
+		priv->hwlock = NULL;
+		goto fail;
+	}
+
+	priv->stat = platform_device_register_data(&priv->provider->dev, "sun6i_hwspinlock_test2",
+						   PLATFORM_DEVID_NONE, &priv->emu,
+						   sizeof(priv->emu));
+	if (IS_ERR(priv->stat)) {
+		err = PTR_ERR(priv->stat);
+		priv->stat = NULL;
+		goto fail;
+	}
+
+	pr_info("[init] emulating %d locks for %s\n", nlocks, name);
+	sun6i_hwspinlock_emu = priv;
+
+	return 0;
+
+fail:
+	pr_info("[init] setting up the emulation failed (%d)\n", err);
+	sun6i_hwspinlock_emu_cleanup(priv);
+
+	return err;
+}
+module_init(sun6i_hwspinlock_emu_init);
+
+static void __exit sun6i_hwspinlock_emu_exit(void)
+{
+	pr_info("[exit]--- SUN6I HWSPINLOCK EMULATION ---\n");
+	sun6i_hwspinlock_emu_cleanup(sun6i_hwspinlock_emu);
+}
+module_exit(sun6i_hwspinlock_emu_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SUN6I hardware spinlock emulation");
+MODULE_AUTHOR("Wilken Gottwalt <wilken.gottwalt@posteo.net>");
@@ -18,11 +18,13 @@
 #include <linux/types.h>
 
 #include "hwspinlock_internal.h"
+#include "../sun6i_hwspinlock_emu.h"
 
 #define DRIVER_NAME		"sun6i_hwspinlock_mod"
 
 #define SPINLOCK_BASE_ID	0 /* there is only one hwspinlock device per SoC */
 #define SPINLOCK_SYSSTATUS_REG	0x0000
+#define SPINLOCK_LOCK_REGN	0x0100 /* only used by the emulated device */
 #define SPINLOCK_NOTTAKEN	0
 
 struct sun6i_hwspinlock_mod_data {
@@ -61,16 +63,24 @@ static void sun6i_hwspinlock_mod_debugfs_init(struct sun6i_hwspinlock_mod_data *
 
 static int sun6i_hwspinlock_mod_trylock(struct hwspinlock *lock)
 {
+	const struct sun6i_hwspinlock_emu *emu = dev_get_platdata(lock->bank->dev);
 	void __iomem *lock_addr = lock->priv;
 
+	if (emu)
+		return (emu->read(emu, lock_addr) == SPINLOCK_NOTTAKEN);
+
 	return (readl(lock_addr) == SPINLOCK_NOTTAKEN);
 }
 
 static void sun6i_hwspinlock_mod_unlock(struct hwspinlock *lock)
 {
+	const struct sun6i_hwspinlock_emu *emu = dev_get_platdata(lock->bank->dev);
 	void __iomem *lock_addr = lock->priv;
 
-	writel(SPINLOCK_NOTTAKEN, lock_addr);
+	if (emu)
+		emu->write(emu, SPINLOCK_NOTTAKEN, lock_addr);
+	else
+		writel(SPINLOCK_NOTTAKEN, lock_addr);
 }
 
 static const struct hwspinlock_ops sun6i_hwspinlock_mod_ops = {
@@ -80,6 +90,7 @@ static const struct hwspinlock_ops sun6i_hwspinlock_mod_ops = {
 
 static int sun6i_hwspinlock_mod_probe(struct platform_device *pdev)
 {
+	const struct sun6i_hwspinlock_emu *emu;
 	struct sun6i_hwspinlock_mod_data *priv;
 	struct hwspinlock *hwlock;
 	void __iomem *io_base;
@@ -87,13 +98,20 @@ static int sun6i_hwspinlock_mod_probe(struct platform_device *pdev)
 	u32 num_banks;
 	int err, i;
 
-	io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
-	if (IS_ERR(io_base))
-		return PTR_ERR(io_base);
-
-	io_locks = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID + 1);
-	if (IS_ERR(io_locks))
-		return PTR_ERR(io_locks);
+	/* the emulated device brings its own register page */
+	emu = dev_get_platdata(&pdev->dev);
+	if (emu) {
+		io_base = emu->base;
+		io_locks = emu->base + SPINLOCK_LOCK_REGN;
+	} else {
+		io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
+		if (IS_ERR(io_base))
+			return PTR_ERR(io_base);
+
+		io_locks = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID + 1);
+		if (IS_ERR(io_locks))
+			return PTR_ERR(io_locks);
+	}
 
 	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv)
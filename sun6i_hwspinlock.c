@@ -4,52 +4,1596 @@
  * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
  */
 
+#include <linux/bug.h>
+#include <linux/cache.h>
 #include <linux/clk.h>
 #include <linux/debugfs.h>
 #include <linux/errno.h>
 #include <linux/hwspinlock.h>
 #include <linux/io.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/kallsyms.h>
+#include <linux/kobject.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
 #include <linux/reset.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/sched/clock.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
+#include <linux/stacktrace.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/timex.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#ifdef CONFIG_ARM_ARCH_TIMER
+#include <clocksource/arm_arch_timer.h>
+#endif
 
 #include "hwspinlock_internal.h"
+#include "sun6i_hwspinlock.h"
+#include "sun6i_hwspinlock_emu.h"
+#include "sun6i_hwspinlock_replay.h"
+#include "sun6i_hwspinlock_trace.h"
+
+#define DRIVER_NAME		"sun6i_hwspinlock"
+
+#define SPINLOCK_BASE_ID	0 /* there is only one hwspinlock device per SoC */
+#define SPINLOCK_SYSSTATUS_REG	0x0000
+#define SPINLOCK_STATUS_REG	0x0010
+#define SPINLOCK_LOCK_REGN	0x0100
+#define SPINLOCK_NOTTAKEN	0
+#define SPINLOCK_TRACE_ENTRIES	1024
+#define SPINLOCK_CALLSITES	256 /* power of two */
+#define SPINLOCK_CALLSITE_DEPTH	8 /* enough to get past the rw lock helpers */
+#define SPINLOCK_RECORDS	65536
+#define SPINLOCK_LEASE_LOCKS	32 /* only the first 32 locks are visible in the status reg */
+#define SPINLOCK_LEASE_PERIOD	10 /* ms */
+#define SPINLOCK_QUOTA_CALIBRATE	1000
+#define SPINLOCK_QUOTA_YIELD_READS	64
+#define SPINLOCK_WAIT_STALE	1000000 /* ns */
+#define SPINLOCK_WAITER_STALE	20000 /* ns */
+
+enum sun6i_hwspinlock_lease_policy {
+	SUN6I_HWSPINLOCK_LEASE_LOG,
+	SUN6I_HWSPINLOCK_LEASE_NOTIFY,
+	SUN6I_HWSPINLOCK_LEASE_RELEASE,
+};
+
+static const char * const sun6i_hwspinlock_lease_policies[] = {
+	[SUN6I_HWSPINLOCK_LEASE_LOG]		= "log",
+	[SUN6I_HWSPINLOCK_LEASE_NOTIFY]		= "notify",
+	[SUN6I_HWSPINLOCK_LEASE_RELEASE]	= "release",
+};
+
+struct sun6i_hwspinlock_data;
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_CALLSITES
+struct sun6i_hwspinlock_callsite {
+	u32 key;
+	unsigned long frames[SPINLOCK_CALLSITE_DEPTH];
+	atomic64_t acquired;
+	atomic64_t spin_ns;
+	atomic64_t hold_ns;
+	atomic64_t irqoff_ns;
+};
+#endif
+
+/* software shadow of a Linux hold, answers ownership queries without a register read */
+struct sun6i_hwspinlock_owner {
+	bool held;
+	struct task_struct *task;	/* NULL if taken outside of task context */
+	pid_t pid;
+	int cpu;
+	unsigned int depth;		/* sun6i hwlocks held on that cpu, including this one */
+	u64 since;
+} ____cacheline_aligned_in_smp;
+
+struct sun6i_hwspinlock_waiter {
+	struct list_head node;
+	ktime_t deadline;
+	int prio;
+};
+
+/*
+ * the hwspinlock core does not take its per lock spinlock in the raw and in_atomic modes, so
+ * Linux users can poll a lock in parallel, state_lock serializes the lock ops and with them
+ * the owner shadow, the quota state and the per lock statistics
+ */
+struct sun6i_hwspinlock_lock {
+	struct sun6i_hwspinlock_data *priv;
+	void __iomem *reg;
+	int id;
+	raw_spinlock_t state_lock;
+	struct sun6i_hwspinlock_owner owner;
+	bool lease_expired;
+	bool lease_reported;
+	u32 lease_us;
+	u64 lease_since;
+	unsigned long lease_expiries;
+	u32 quota_burst;
+	u32 quota_share;
+	u64 quota_window_ns;
+	u64 quota_yield_ns;
+	u32 quota_count;
+	u64 quota_taken;
+	u64 quota_held_ns;
+	u64 quota_window_start;
+	u64 quota_yield_until;
+	unsigned long quota_throttled;
+	unsigned long quota_yielded;
+	raw_spinlock_t waiters_lock;
+	struct list_head waiters;
+	struct sun6i_hwspinlock_waiter *waiter_head;
+	s64 waiter_polled;
+#ifdef CONFIG_HWSPINLOCK_SUN6I_TRACE
+	bool spinning;
+	u64 spin_last;
+#endif
+#ifdef CONFIG_HWSPINLOCK_SUN6I_CALLSITES
+	struct sun6i_hwspinlock_callsite *site;
+	u64 spin_start;
+	u64 spin_failed;
+	u64 taken;
+	bool irqoff;
+#endif
+#ifdef CONFIG_HWSPINLOCK_SUN6I_RECORD
+	u64 arrival;
+	u64 arrival_failed;
+	u64 record_taken;
+	u32 record;
+	u32 record_gen;
+#endif
+};
+
+struct sun6i_hwspinlock_data {
+	struct hwspinlock_device *bank;
+	struct sun6i_hwspinlock_lock *locks;
+	struct device *dev;
+	void __iomem *io_base;
+	const struct sun6i_hwspinlock_emu *emu;
+	atomic_t __percpu *held;
+	struct delayed_work lease_work;
+	bool lease_started;
+	enum sun6i_hwspinlock_lease_policy lease_policy;
+	u64 quota_yield_ns;
+	struct reset_control *reset;
+	struct clk *ahb_clk;
+	struct dentry *debugfs;
+	int nlocks;
+#ifdef CONFIG_HWSPINLOCK_SUN6I_TRACE
+	raw_spinlock_t trace_lock;
+	struct sun6i_hwspinlock_trace_ring *trace;
+	struct sun6i_hwspinlock_trace_ring *fw_trace;
+	size_t fw_trace_len;
+#endif
+#ifdef CONFIG_HWSPINLOCK_SUN6I_CALLSITES
+	struct sun6i_hwspinlock_callsite *sites;
+	atomic_t sites_dropped;
+#endif
+#ifdef CONFIG_HWSPINLOCK_SUN6I_RECORD
+	raw_spinlock_t record_lock;
+	struct mutex record_mutex;
+	struct sun6i_hwspinlock_replay_record *records;
+	u32 record_count;
+	u32 record_gen;
+	u64 record_last;
+	bool recording;
+#endif
+};
+
+static u32 sun6i_hwspinlock_read(struct sun6i_hwspinlock_lock *hwl)
+{
+	const struct sun6i_hwspinlock_emu *emu = hwl->priv->emu;
+
+	return emu ? emu->read(emu, hwl->reg) : readl(hwl->reg);
+}
+
+static void sun6i_hwspinlock_write(struct sun6i_hwspinlock_lock *hwl, u32 val)
+{
+	const struct sun6i_hwspinlock_emu *emu = hwl->priv->emu;
+
+	if (emu)
+		emu->write(emu, val, hwl->reg);
+	else
+		writel(val, hwl->reg);
+}
+
+/*
+ * a waiter polls its lock back to back, a longer pause after the last failed attempt means
+ * the waiter gave up (hwspin_trylock() or an expired timeout), the next attempt starts a new
+ * wait then
+ */
+static inline bool sun6i_hwspinlock_wait_stale(u64 last, u64 now)
+{
+	return now - last > SPINLOCK_WAIT_STALE;
+}
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_TRACE
+
+static u64 sun6i_hwspinlock_trace_stamp(void)
+{
+#ifdef CONFIG_ARM_ARCH_TIMER
+	return arch_timer_read_counter();
+#else
+	return get_cycles();
+#endif
+}
+
+static u32 sun6i_hwspinlock_trace_rate(void)
+{
+#ifdef CONFIG_ARM_ARCH_TIMER
+	return arch_timer_get_rate();
+#else
+	return 0;
+#endif
+}
+
+static void sun6i_hwspinlock_trace_event(struct sun6i_hwspinlock_lock *hwl, u8 event)
+{
+	struct sun6i_hwspinlock_data *priv = hwl->priv;
+	struct sun6i_hwspinlock_trace_ring *ring = priv->trace;
+	struct sun6i_hwspinlock_trace_entry *entry;
+	unsigned long flags;
+	u32 head;
+
+	/* the stamp is taken under the lock, this keeps the Linux ring in counter order */
+	raw_spin_lock_irqsave(&priv->trace_lock, flags);
+	head = ring->head;
+	entry = &ring->entries[head & (ring->size - 1)];
+	entry->stamp = sun6i_hwspinlock_trace_stamp();
+	entry->lock = hwl->id;
+	entry->event = event;
+	entry->side = SUN6I_HWSPINLOCK_TRACE_LINUX;
+	entry->cpu = raw_smp_processor_id();
+	smp_store_release(&ring->head, head + 1);
+	raw_spin_unlock_irqrestore(&priv->trace_lock, flags);
+}
+
+/* called with the state lock held */
+static void sun6i_hwspinlock_trace_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+	u64 now = local_clock();
+
+	if (hwl->spinning && sun6i_hwspinlock_wait_stale(hwl->spin_last, now))
+		hwl->spinning = false;
+
+	if (taken) {
+		hwl->spinning = false;
+		sun6i_hwspinlock_trace_event(hwl, SUN6I_HWSPINLOCK_TRACE_TAKEN);
+		return;
+	}
+
+	if (!hwl->spinning) {
+		hwl->spinning = true;
+		sun6i_hwspinlock_trace_event(hwl, SUN6I_HWSPINLOCK_TRACE_SPIN);
+	}
+	hwl->spin_last = now;
+}
+
+static void sun6i_hwspinlock_trace_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+	sun6i_hwspinlock_trace_event(hwl, SUN6I_HWSPINLOCK_TRACE_RELEASED);
+}
+
+static int sun6i_hwspinlock_trace_init(struct platform_device *pdev,
+				       struct sun6i_hwspinlock_data *priv)
+{
+	struct device_node *np;
+	struct resource res;
+	int err;
+
+	priv->trace = devm_kzalloc(&pdev->dev,
+				   struct_size(priv->trace, entries, SPINLOCK_TRACE_ENTRIES),
+				   GFP_KERNEL);
+	if (!priv->trace)
+		return -ENOMEM;
+
+	raw_spin_lock_init(&priv->trace_lock);
+	priv->trace->magic = SUN6I_HWSPINLOCK_TRACE_MAGIC;
+	priv->trace->version = SUN6I_HWSPINLOCK_TRACE_VERSION;
+	priv->trace->size = SPINLOCK_TRACE_ENTRIES;
+	priv->trace->rate = sun6i_hwspinlock_trace_rate();
+
+	/* the firmware ring is optional, without it only the Linux events are available */
+	np = of_parse_phandle(pdev->dev.of_node, "memory-region", 0);
+	if (!np)
+		return 0;
+
+	err = of_address_to_resource(np, 0, &res);
+	of_node_put(np);
+	if (err)
+		return err;
+
+	priv->fw_trace = devm_memremap(&pdev->dev, res.start, resource_size(&res), MEMREMAP_WC);
+	if (IS_ERR(priv->fw_trace))
+		return PTR_ERR(priv->fw_trace);
+	priv->fw_trace_len = resource_size(&res);
+
+	return 0;
+}
+
+#else
+
+static void sun6i_hwspinlock_trace_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+}
+
+static void sun6i_hwspinlock_trace_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+}
+
+static int sun6i_hwspinlock_trace_init(struct platform_device *pdev,
+				       struct sun6i_hwspinlock_data *priv)
+{
+	return 0;
+}
+
+#endif
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_CALLSITES
+
+/*
+ * _RET_IP_ of the ops callbacks points into the hwspinlock core, so a short stack is recorded
+ * instead and the consumer frame is picked out of it when the report is generated
+ */
+static struct sun6i_hwspinlock_callsite *
+sun6i_hwspinlock_callsite_get(struct sun6i_hwspinlock_data *priv)
+{
+	unsigned long frames[SPINLOCK_CALLSITE_DEPTH] = { 0 };
+	struct sun6i_hwspinlock_callsite *site;
+	unsigned int nr, i;
+	u32 key;
+
+	nr = stack_trace_save(frames, SPINLOCK_CALLSITE_DEPTH, 0);
+	key = jhash(frames, nr * sizeof(frames[0]), 0) ?: 1;
+
+	/* lock-free open addressing, slots are claimed once and never released */
+	for (i = 0; i < SPINLOCK_CALLSITES; ++i) {
+		site = &priv->sites[(key + i) & (SPINLOCK_CALLSITES - 1)];
+		if (READ_ONCE(site->key) == key)
+			return site;
+
+		if (!READ_ONCE(site->key) && !cmpxchg(&site->key, 0, key)) {
+			memcpy(site->frames, frames, sizeof(frames));
+			return site;
+		}
+	}
+
+	atomic_inc(&priv->sites_dropped);
+
+	return NULL;
+}
+
+/* called with the state lock held */
+static void sun6i_hwspinlock_callsite_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+	u64 now = local_clock(), spin_start;
+
+	/* a waiter which gave up must not charge its spin time to the next taker */
+	if (hwl->spin_start && sun6i_hwspinlock_wait_stale(hwl->spin_failed, now))
+		hwl->spin_start = 0;
+
+	if (!taken) {
+		if (!hwl->spin_start)
+			hwl->spin_start = now;
+		hwl->spin_failed = now;
+		return;
+	}
+
+	hwl->site = sun6i_hwspinlock_callsite_get(hwl->priv);
+	hwl->irqoff = irqs_disabled();
+	hwl->taken = now;
+	spin_start = hwl->spin_start;
+	hwl->spin_start = 0;
+	if (!hwl->site)
+		return;
+
+	atomic64_inc(&hwl->site->acquired);
+	if (spin_start)
+		atomic64_add(now - spin_start, &hwl->site->spin_ns);
+}
+
+/*
+ * only the hold counts as IRQ-off time, the _irq and _irqsave modes of the core enable
+ * interrupts again between two failed attempts
+ */
+static void sun6i_hwspinlock_callsite_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+	u64 held = local_clock() - hwl->taken;
+
+	if (!hwl->site)
+		return;
+
+	atomic64_add(held, &hwl->site->hold_ns);
+	if (hwl->irqoff)
+		atomic64_add(held, &hwl->site->irqoff_ns);
+	hwl->site = NULL;
+}
+
+static int sun6i_hwspinlock_callsite_init(struct platform_device *pdev,
+					  struct sun6i_hwspinlock_data *priv)
+{
+	priv->sites = devm_kcalloc(&pdev->dev, SPINLOCK_CALLSITES, sizeof(*priv->sites),
+				   GFP_KERNEL);
+	if (!priv->sites)
+		return -ENOMEM;
+
+	return 0;
+}
+
+#else
+
+static void sun6i_hwspinlock_callsite_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+}
+
+static void sun6i_hwspinlock_callsite_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+}
+
+static int sun6i_hwspinlock_callsite_init(struct platform_device *pdev,
+					  struct sun6i_hwspinlock_data *priv)
+{
+	return 0;
+}
+
+#endif
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_RECORD
+
+static u32 sun6i_hwspinlock_record_ns(u64 ns)
+{
+	return min_t(u64, ns, U32_MAX);
+}
+
+static void sun6i_hwspinlock_record_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+	struct sun6i_hwspinlock_data *priv = hwl->priv;
+	struct sun6i_hwspinlock_replay_record *rec;
+	unsigned long flags;
+	u64 now;
+
+	if (!READ_ONCE(priv->recording))
+		return;
+
+	now = ktime_get_ns();
+	if (hwl->arrival && sun6i_hwspinlock_wait_stale(hwl->arrival_failed, now))
+		hwl->arrival = 0;
+	if (!hwl->arrival)
+		hwl->arrival = now;
+	if (!taken) {
+		hwl->arrival_failed = now;
+		return;
+	}
+
+	raw_spin_lock_irqsave(&priv->record_lock, flags);
+	if (priv->recording && priv->record_count < SPINLOCK_RECORDS) {
+		/*
+		 * records are added in the order the locks were taken, a waiter which arrived
+		 * before the previous record but took longer to get its lock gets no gap
+		 */
+		rec = &priv->records[priv->record_count++];
+		rec->gap_ns = priv->record_last ?
+			      sun6i_hwspinlock_record_ns(max_t(s64, 0, hwl->arrival -
+							       priv->record_last)) : 0;
+		rec->hold_ns = 0;
+		rec->lock = hwl->id;
+		rec->cpu = raw_smp_processor_id();
+		rec->reserved = 0;
+		priv->record_last = max(priv->record_last, hwl->arrival);
+		hwl->record = priv->record_count;
+		hwl->record_gen = priv->record_gen;
+		hwl->record_taken = now;
+	} else {
+		/* a full buffer ends the recording */
+		WRITE_ONCE(priv->recording, false);
+	}
+	raw_spin_unlock_irqrestore(&priv->record_lock, flags);
+
+	hwl->arrival = 0;
+}
+
+static void sun6i_hwspinlock_record_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+	struct sun6i_hwspinlock_data *priv = hwl->priv;
+	unsigned long flags;
+	u64 held;
+
+	if (!hwl->record)
+		return;
+
+	held = ktime_get_ns() - hwl->record_taken;
+
+	/* the recording may have been restarted since the lock was taken */
+	raw_spin_lock_irqsave(&priv->record_lock, flags);
+	if (hwl->record_gen == priv->record_gen && hwl->record <= priv->record_count)
+		priv->records[hwl->record - 1].hold_ns = sun6i_hwspinlock_record_ns(held);
+	raw_spin_unlock_irqrestore(&priv->record_lock, flags);
+
+	hwl->record = 0;
+}
+
+static int sun6i_hwspinlock_record_start(struct sun6i_hwspinlock_data *priv)
+{
+	unsigned long flags;
+
+	if (!priv->records) {
+		priv->records = vmalloc(array_size(SPINLOCK_RECORDS, sizeof(*priv->records)));
+		if (!priv->records)
+			return -ENOMEM;
+	}
+
+	raw_spin_lock_irqsave(&priv->record_lock, flags);
+	priv->record_count = 0;
+	priv->record_last = 0;
+	++priv->record_gen;
+	WRITE_ONCE(priv->recording, true);
+	raw_spin_unlock_irqrestore(&priv->record_lock, flags);
+
+	return 0;
+}
+
+static void sun6i_hwspinlock_record_stop(struct sun6i_hwspinlock_data *priv)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&priv->record_lock, flags);
+	WRITE_ONCE(priv->recording, false);
+	raw_spin_unlock_irqrestore(&priv->record_lock, flags);
+}
+
+static void sun6i_hwspinlock_record_init(struct sun6i_hwspinlock_data *priv)
+{
+	raw_spin_lock_init(&priv->record_lock);
+	mutex_init(&priv->record_mutex);
+}
+
+static void sun6i_hwspinlock_record_free(struct sun6i_hwspinlock_data *priv)
+{
+	vfree(priv->records);
+}
+
+#else
+
+static void sun6i_hwspinlock_record_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+}
+
+static void sun6i_hwspinlock_record_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+}
+
+static void sun6i_hwspinlock_record_init(struct sun6i_hwspinlock_data *priv)
+{
+}
+
+static void sun6i_hwspinlock_record_free(struct sun6i_hwspinlock_data *priv)
+{
+}
+
+#endif
+
+/*
+ * the shadow is only written by the Linux holder, so a context asking about its own locks
+ * always sees its own writes, holders outside of task context are identified by their cpu
+ */
+static void sun6i_hwspinlock_owner_set(struct sun6i_hwspinlock_lock *hwl)
+{
+	struct sun6i_hwspinlock_owner *owner = &hwl->owner;
+	int cpu = raw_smp_processor_id();
+
+	owner->task = in_task() ? current : NULL;
+	owner->pid = in_task() ? task_pid_nr(current) : 0;
+	owner->cpu = cpu;
+	owner->depth = atomic_inc_return(per_cpu_ptr(hwl->priv->held, cpu));
+	owner->since = local_clock();
+	smp_store_release(&owner->held, true);
+}
+
+/* raw mode users may have migrated, so the depth is given back to the cpu which took it */
+static void sun6i_hwspinlock_owner_clear(struct sun6i_hwspinlock_lock *hwl)
+{
+	struct sun6i_hwspinlock_owner *owner = &hwl->owner;
+
+	atomic_dec(per_cpu_ptr(hwl->priv->held, owner->cpu));
+	WRITE_ONCE(owner->held, false);
+	WRITE_ONCE(owner->task, NULL);
+}
+
+static bool sun6i_hwspinlock_owned(struct sun6i_hwspinlock_lock *hwl)
+{
+	struct sun6i_hwspinlock_owner *owner = &hwl->owner;
+
+	if (!smp_load_acquire(&owner->held))
+		return false;
+
+	if (in_task())
+		return READ_ONCE(owner->task) == current;
+
+	return !READ_ONCE(owner->task) && READ_ONCE(owner->cpu) == raw_smp_processor_id();
+}
+
+static int sun6i_hwspinlock_deadlock_check(struct sun6i_hwspinlock_lock *hwl)
+{
+	if (WARN(sun6i_hwspinlock_owned(hwl), "hwlock %d already held by this context\n",
+		 hwl->id))
+		return -EDEADLK;
+
+	return 0;
+}
+
+static void sun6i_hwspinlock_lease_expire(struct sun6i_hwspinlock_data *priv,
+					  struct sun6i_hwspinlock_lock *hwl)
+{
+	struct hwspinlock *hwlock = &priv->bank->lock[hwl->id];
+	char lockstr[16], *envp[] = { "EVENT=lease_expired", lockstr, NULL };
+	enum sun6i_hwspinlock_lease_policy policy = READ_ONCE(priv->lease_policy);
+	unsigned long flags;
+
+	/* every expired hold is counted and reported once */
+	if (!hwl->lease_reported) {
+		hwl->lease_reported = true;
+		++hwl->lease_expiries;
+		dev_warn(priv->dev, "lock %d held remotely for more than %u us\n", hwl->id,
+			 READ_ONCE(hwl->lease_us));
+
+		switch (policy) {
+		case SUN6I_HWSPINLOCK_LEASE_NOTIFY:
+			snprintf(lockstr, sizeof(lockstr), "HWLOCK=%d", hwl->id);
+			kobject_uevent_env(&priv->dev->kobj, KOBJ_CHANGE, envp);
+			fallthrough;
+		case SUN6I_HWSPINLOCK_LEASE_LOG:
+			WRITE_ONCE(hwl->lease_expired, true);
+			break;
+		case SUN6I_HWSPINLOCK_LEASE_RELEASE:
+			break;
+		}
+	}
+
+	if (policy != SUN6I_HWSPINLOCK_LEASE_RELEASE)
+		return;
+
+	/*
+	 * holding the core lock keeps Linux users away while the lock is cleared, users of the
+	 * raw modes do not take it and are only covered by the owner shadow, a busy core lock
+	 * is retried quietly in the next period
+	 */
+	if (!spin_trylock_irqsave(&hwlock->lock, flags))
+		return;
+	if (!READ_ONCE(hwl->owner.held)) {
+		sun6i_hwspinlock_write(hwl, SPINLOCK_NOTTAKEN);
+		hwl->lease_since = 0;
+		hwl->lease_reported = false;
+		dev_warn(priv->dev, "lock %d forcibly released\n", hwl->id);
+	}
+	spin_unlock_irqrestore(&hwlock->lock, flags);
+}
+
+/*
+ * the watchdog only sees which locks are taken, a remote user which releases and takes a lock
+ * again between two periods is considered one long hold
+ */
+static void sun6i_hwspinlock_lease_watchdog(struct work_struct *work)
+{
+	struct sun6i_hwspinlock_data *priv = container_of(work, struct sun6i_hwspinlock_data,
+							  lease_work.work);
+	struct sun6i_hwspinlock_lock *hwl;
+	bool active = false;
+	u64 now;
+	u32 status;
+	int i;
+
+	status = readl(priv->io_base + SPINLOCK_STATUS_REG);
+	now = ktime_get_ns();
+
+	for (i = 0; i < min(priv->nlocks, SPINLOCK_LEASE_LOCKS); ++i) {
+		hwl = &priv->locks[i];
+		if (!READ_ONCE(hwl->lease_us))
+			continue;
+
+		active = true;
+		if (!(status & BIT(i)) || READ_ONCE(hwl->owner.held)) {
+			hwl->lease_since = 0;
+			hwl->lease_reported = false;
+			WRITE_ONCE(hwl->lease_expired, false);
+			continue;
+		}
+
+		if (!hwl->lease_since)
+			hwl->lease_since = now;
+		else if (now - hwl->lease_since > (u64)READ_ONCE(hwl->lease_us) * NSEC_PER_USEC)
+			sun6i_hwspinlock_lease_expire(priv, hwl);
+	}
+
+	if (active)
+		schedule_delayed_work(&priv->lease_work, msecs_to_jiffies(SPINLOCK_LEASE_PERIOD));
+}
+
+static int sun6i_hwspinlock_lease_set(struct sun6i_hwspinlock_data *priv, int id, u32 budget)
+{
+	if (id < 0 || id >= min(priv->nlocks, SPINLOCK_LEASE_LOCKS))
+		return -EINVAL;
+
+	WRITE_ONCE(priv->locks[id].lease_us, budget);
+	if (budget && READ_ONCE(priv->lease_started))
+		schedule_delayed_work(&priv->lease_work, msecs_to_jiffies(SPINLOCK_LEASE_PERIOD));
+
+	return 0;
+}
+
+/* the watchdog takes the core locks, which are only set up once the bank is registered */
+static void sun6i_hwspinlock_lease_start(struct sun6i_hwspinlock_data *priv)
+{
+	WRITE_ONCE(priv->lease_started, true);
+	schedule_delayed_work(&priv->lease_work, msecs_to_jiffies(SPINLOCK_LEASE_PERIOD));
+}
+
+/*
+ * leases are set by pairs of lock and budget in us, like
+ * allwinner,lease-us = <0 500>, <3 2000>;
+ * allwinner,lease-policy = "release";
+ */
+static int sun6i_hwspinlock_lease_init(struct platform_device *pdev,
+				       struct sun6i_hwspinlock_data *priv)
+{
+	struct device_node *np = pdev->dev.of_node;
+	const char *policy;
+	u32 *leases;
+	int count, err, i;
+
+	INIT_DELAYED_WORK(&priv->lease_work, sun6i_hwspinlock_lease_watchdog);
+	priv->lease_policy = SUN6I_HWSPINLOCK_LEASE_LOG;
+
+	if (!of_property_read_string(np, "allwinner,lease-policy", &policy)) {
+		err = match_string(sun6i_hwspinlock_lease_policies,
+				   ARRAY_SIZE(sun6i_hwspinlock_lease_policies), policy);
+		if (err < 0)
+			return err;
+		priv->lease_policy = err;
+	}
+
+	count = of_property_count_u32_elems(np, "allwinner,lease-us");
+	if (count <= 0)
+		return 0;
+	if (count % 2)
+		return -EINVAL;
+
+	leases = kcalloc(count, sizeof(*leases), GFP_KERNEL);
+	if (!leases)
+		return -ENOMEM;
+
+	err = of_property_read_u32_array(np, "allwinner,lease-us", leases, count);
+	for (i = 0; !err && i < count; i += 2)
+		err = sun6i_hwspinlock_lease_set(priv, leases[i], leases[i + 1]);
+
+	kfree(leases);
+
+	return err;
+}
+
+static int sun6i_hwspinlock_lease_check(struct sun6i_hwspinlock_lock *hwl)
+{
+	return READ_ONCE(hwl->lease_expired) ? -EOWNERDEAD : 0;
+}
+
+/*
+ * the default yield window gives the companion core time for a few polls of its lock
+ * register, so it is based on the time the ARM side needs for one register read
+ */
+static void sun6i_hwspinlock_quota_calibrate(struct sun6i_hwspinlock_data *priv)
+{
+	u64 start, elapsed;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < SPINLOCK_QUOTA_CALIBRATE; ++i)
+		readl(priv->io_base + SPINLOCK_SYSSTATUS_REG);
+	elapsed = ktime_get_ns() - start;
+
+	priv->quota_yield_ns = max_t(u64, NSEC_PER_USEC,
+				     div_u64(elapsed * SPINLOCK_QUOTA_YIELD_READS,
+					     SPINLOCK_QUOTA_CALIBRATE));
+}
+
+static bool sun6i_hwspinlock_quota_enabled(struct sun6i_hwspinlock_lock *hwl)
+{
+	return READ_ONCE(hwl->quota_burst) || READ_ONCE(hwl->quota_share);
+}
+
+/* returns true if Linux has to leave the lock to the companion core for now */
+static bool sun6i_hwspinlock_quota_yield(struct sun6i_hwspinlock_lock *hwl)
+{
+	if (!hwl->quota_yield_until)
+		return false;
+
+	if (ktime_get_ns() < hwl->quota_yield_until) {
+		++hwl->quota_yielded;
+		return true;
+	}
+
+	hwl->quota_yield_until = 0;
+	hwl->quota_count = 0;
+
+	return false;
+}
+
+static void sun6i_hwspinlock_quota_trylock(struct sun6i_hwspinlock_lock *hwl, int taken)
+{
+	/* a lock busy on the remote side means the companion core got its turn */
+	if (!taken) {
+		hwl->quota_count = 0;
+		return;
+	}
+
+	++hwl->quota_count;
+	hwl->quota_taken = ktime_get_ns();
+}
+
+static void sun6i_hwspinlock_quota_unlock(struct sun6i_hwspinlock_lock *hwl)
+{
+	u32 burst = READ_ONCE(hwl->quota_burst), share = READ_ONCE(hwl->quota_share);
+	u64 window = READ_ONCE(hwl->quota_window_ns);
+	u64 yield = READ_ONCE(hwl->quota_yield_ns) ?: hwl->priv->quota_yield_ns;
+	u64 now = ktime_get_ns(), taken = hwl->quota_taken;
+
+	/* the quota may have been enabled while the lock was held */
+	hwl->quota_taken = 0;
+	if (!taken)
+		return;
+
+	if (burst && hwl->quota_count >= burst) {
+		hwl->quota_yield_until = now + yield;
+		++hwl->quota_throttled;
+		return;
+	}
+
+	if (!share || !window)
+		return;
+
+	if (now - hwl->quota_window_start > window) {
+		hwl->quota_window_start = now;
+		hwl->quota_held_ns = 0;
+	}
+
+	/* the share of the window is used up, so leave the rest of it to the companion core */
+	hwl->quota_held_ns += now - taken;
+	if (hwl->quota_held_ns * 100 > share * window) {
+		hwl->quota_yield_until = max(now + yield, hwl->quota_window_start + window);
+		++hwl->quota_throttled;
+	}
+}
+
+static int sun6i_hwspinlock_quota_set(struct sun6i_hwspinlock_data *priv, int id, u32 burst,
+				      u32 share, u32 window_us, u32 yield_us)
+{
+	struct sun6i_hwspinlock_lock *hwl;
+
+	if (id < 0 || id >= priv->nlocks || share > 100 || (share && !window_us))
+		return -EINVAL;
+
+	hwl = &priv->locks[id];
+	WRITE_ONCE(hwl->quota_window_ns, (u64)window_us * NSEC_PER_USEC);
+	WRITE_ONCE(hwl->quota_yield_ns, (u64)yield_us * NSEC_PER_USEC);
+	WRITE_ONCE(hwl->quota_share, share);
+	WRITE_ONCE(hwl->quota_burst, burst);
+
+	return 0;
+}
+
+/*
+ * quotas are set by tuples of lock, max consecutive acquisitions, max share of the window in
+ * percent and window length in us, 0 disables a limit, like
+ * allwinner,quotas = <0 8 0 0>, <3 0 50 1000>;
+ */
+static int sun6i_hwspinlock_quota_init(struct platform_device *pdev,
+				       struct sun6i_hwspinlock_data *priv)
+{
+	struct device_node *np = pdev->dev.of_node;
+	u32 *quotas;
+	int count, err, i;
+
+	sun6i_hwspinlock_quota_calibrate(priv);
+
+	count = of_property_count_u32_elems(np, "allwinner,quotas");
+	if (count <= 0)
+		return 0;
+	if (count % 4)
+		return -EINVAL;
+
+	quotas = kcalloc(count, sizeof(*quotas), GFP_KERNEL);
+	if (!quotas)
+		return -ENOMEM;
+
+	err = of_property_read_u32_array(np, "allwinner,quotas", quotas, count);
+	for (i = 0; !err && i < count; i += 4)
+		err = sun6i_hwspinlock_quota_set(priv, quotas[i], quotas[i + 1], quotas[i + 2],
+						 quotas[i + 3], 0);
+
+	kfree(quotas);
+
+	return err;
+}
+
+#ifdef CONFIG_DEBUG_FS
+
+static int hwlocks_supported_show(struct seq_file *seqf, void *unused)
+{
+	struct sun6i_hwspinlock_data *priv = seqf->private;
+
+	seq_printf(seqf, "%d\n", priv->nlocks);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hwlocks_supported);
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_TRACE
+
+struct sun6i_hwspinlock_timeline_entry {
+	struct sun6i_hwspinlock_trace_entry entry;
+	u64 waited;
+	u8 holder;
+};
+
+struct sun6i_hwspinlock_timeline {
+	u32 rate;
+	u32 count;
+	struct sun6i_hwspinlock_timeline_entry entries[];
+};
+
+static const char *sun6i_hwspinlock_side_name(u8 side)
+{
+	switch (side) {
+	case SUN6I_HWSPINLOCK_TRACE_LINUX:
+		return "linux";
+	case SUN6I_HWSPINLOCK_TRACE_FIRMWARE:
+		return "firmware";
+	default:
+		return "unknown";
+	}
+}
+
+static const char *sun6i_hwspinlock_event_name(u8 event)
+{
+	switch (event) {
+	case SUN6I_HWSPINLOCK_TRACE_SPIN:
+		return "spin";
+	case SUN6I_HWSPINLOCK_TRACE_TAKEN:
+		return "taken";
+	case SUN6I_HWSPINLOCK_TRACE_RELEASED:
+		return "released";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+ * copies the valid part of a ring into buf (which must hold max entries), entries overwritten
+ * by the producer while copying are dropped, returns the number of copied entries
+ */
+static u32 sun6i_hwspinlock_trace_snapshot(const struct sun6i_hwspinlock_trace_ring *ring,
+					   size_t len, struct sun6i_hwspinlock_trace_entry *buf,
+					   u32 max)
+{
+	u32 size, head, next, count, first, lost = 0, i;
+
+	/* the firmware clears the magic before it sets up the ring */
+	if (!ring || smp_load_acquire(&ring->magic) != SUN6I_HWSPINLOCK_TRACE_MAGIC ||
+	    READ_ONCE(ring->version) != SUN6I_HWSPINLOCK_TRACE_VERSION)
+		return 0;
+
+	size = READ_ONCE(ring->size);
+	if (!is_power_of_2(size) || size > max || struct_size(ring, entries, size) > len)
+		return 0;
+
+	head = smp_load_acquire(&ring->head);
+	count = min(head, size);
+	first = head - count;
+	for (i = 0; i < count; ++i)
+		buf[i] = ring->entries[(first + i) & (size - 1)];
+
+	/*
+	 * the producer fills slot next before it publishes next + 1, so that slot may be torn
+	 * too, everything older than size entries before it is overwritten
+	 */
+	smp_rmb();
+	next = READ_ONCE(ring->head);
+	if (next + 1 - first > size)
+		lost = min(next + 1 - first - size, count);
+	memmove(buf, buf + lost, (count - lost) * sizeof(*buf));
+
+	return count - lost;
+}
+
+static struct sun6i_hwspinlock_timeline *
+sun6i_hwspinlock_timeline_build(struct sun6i_hwspinlock_data *priv)
+{
+	struct sun6i_hwspinlock_trace_entry *lbuf = NULL, *fbuf = NULL, *e;
+	struct sun6i_hwspinlock_timeline *tl = NULL;
+	struct sun6i_hwspinlock_timeline_entry *te;
+	u32 fmax = 0, lcount, fcount, li = 0, fi = 0;
+	u8 holder[256];
+	u64 (*spin_start)[256];
+
+	spin_start = kcalloc(SUN6I_HWSPINLOCK_TRACE_FIRMWARE + 1, sizeof(*spin_start), GFP_KERNEL);
+	if (!spin_start)
+		return ERR_PTR(-ENOMEM);
+
+	lbuf = kvmalloc_array(SPINLOCK_TRACE_ENTRIES, sizeof(*lbuf), GFP_KERNEL);
+	if (!lbuf)
+		goto out;
+
+	if (priv->fw_trace) {
+		fmax = priv->fw_trace_len / sizeof(*fbuf);
+		fbuf = kvmalloc_array(fmax, sizeof(*fbuf), GFP_KERNEL);
+		if (!fbuf)
+			goto out;
+	}
+
+	lcount = sun6i_hwspinlock_trace_snapshot(priv->trace,
+						 struct_size(priv->trace, entries,
+							     SPINLOCK_TRACE_ENTRIES),
+						 lbuf, SPINLOCK_TRACE_ENTRIES);
+	fcount = sun6i_hwspinlock_trace_snapshot(priv->fw_trace, priv->fw_trace_len, fbuf, fmax);
+
+	tl = kvzalloc(struct_size(tl, entries, lcount + fcount), GFP_KERNEL);
+	if (!tl)
+		goto out;
+
+	tl->rate = priv->trace->rate;
+	tl->count = lcount + fcount;
+
+	/*
+	 * both rings are in counter order, so a plain merge gives the combined timeline, the
+	 * holder of each lock is replayed to show which side held it while the other one spun
+	 */
+	memset(holder, SUN6I_HWSPINLOCK_TRACE_NONE, sizeof(holder));
+	for (te = tl->entries; li < lcount || fi < fcount; ++te) {
+		if (fi == fcount || (li < lcount && lbuf[li].stamp <= fbuf[fi].stamp))
+			e = &lbuf[li++];
+		else
+			e = &fbuf[fi++];
+
+		te->entry = *e;
+		te->holder = holder[e->lock];
+		if (e->side > SUN6I_HWSPINLOCK_TRACE_FIRMWARE)
+			continue;
+
+		switch (e->event) {
+		case SUN6I_HWSPINLOCK_TRACE_SPIN:
+			spin_start[e->side][e->lock] = e->stamp;
+			break;
+		case SUN6I_HWSPINLOCK_TRACE_TAKEN:
+			if (spin_start[e->side][e->lock])
+				te->waited = e->stamp - spin_start[e->side][e->lock];
+			spin_start[e->side][e->lock] = 0;
+			holder[e->lock] = e->side;
+			break;
+		case SUN6I_HWSPINLOCK_TRACE_RELEASED:
+			holder[e->lock] = SUN6I_HWSPINLOCK_TRACE_NONE;
+			break;
+		}
+	}
+
+out:
+	kvfree(fbuf);
+	kvfree(lbuf);
+	kfree(spin_start);
+
+	return tl ? tl : ERR_PTR(-ENOMEM);
+}
+
+static void *hwlocks_timeline_start(struct seq_file *seqf, loff_t *pos)
+{
+	struct sun6i_hwspinlock_timeline *tl = seqf->private;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+
+	return (*pos <= tl->count) ? &tl->entries[*pos - 1] : NULL;
+}
+
+static void *hwlocks_timeline_next(struct seq_file *seqf, void *v, loff_t *pos)
+{
+	++*pos;
+
+	return hwlocks_timeline_start(seqf, pos);
+}
+
+static void hwlocks_timeline_stop(struct seq_file *seqf, void *v)
+{
+}
+
+static int hwlocks_timeline_show(struct seq_file *seqf, void *v)
+{
+	struct sun6i_hwspinlock_timeline *tl = seqf->private;
+	struct sun6i_hwspinlock_timeline_entry *te = v;
+	struct sun6i_hwspinlock_trace_entry *e;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(seqf, "# counter rate %u Hz\n", tl->rate);
+		seq_puts(seqf, "# stamp side cpu lock event\n");
+		return 0;
+	}
+
+	e = &te->entry;
+	seq_printf(seqf, "%llu %s %u %u %s", e->stamp, sun6i_hwspinlock_side_name(e->side),
+		   e->cpu, e->lock, sun6i_hwspinlock_event_name(e->event));
+	if (e->event == SUN6I_HWSPINLOCK_TRACE_SPIN &&
+	    te->holder != SUN6I_HWSPINLOCK_TRACE_NONE && te->holder != e->side)
+		seq_printf(seqf, " held by %s", sun6i_hwspinlock_side_name(te->holder));
+	if (te->waited)
+		seq_printf(seqf, " after %llu", te->waited);
+	seq_putc(seqf, '\n');
+
+	return 0;
+}
+
+static const struct seq_operations hwlocks_timeline_sops = {
+	.start	= hwlocks_timeline_start,
+	.next	= hwlocks_timeline_next,
+	.stop	= hwlocks_timeline_stop,
+	.show	= hwlocks_timeline_show,
+};
+
+static int hwlocks_timeline_open(struct inode *inode, struct file *file)
+{
+	struct sun6i_hwspinlock_timeline *tl;
+	int err;
+
+	tl = sun6i_hwspinlock_timeline_build(inode->i_private);
+	if (IS_ERR(tl))
+		return PTR_ERR(tl);
+
+	err = seq_open(file, &hwlocks_timeline_sops);
+	if (err) {
+		kvfree(tl);
+		return err;
+	}
+	((struct seq_file *)file->private_data)->private = tl;
+
+	return 0;
+}
+
+static int hwlocks_timeline_release(struct inode *inode, struct file *file)
+{
+	kvfree(((struct seq_file *)file->private_data)->private);
 
-#define DRIVER_NAME		"sun6i_hwspinlock"
+	return seq_release(inode, file);
+}
 
-#define SPINLOCK_BASE_ID	0 /* there is only one hwspinlock device per SoC */
-#define SPINLOCK_SYSSTATUS_REG	0x0000
-#define SPINLOCK_LOCK_REGN	0x0100
-#define SPINLOCK_NOTTAKEN	0
+static const struct file_operations hwlocks_timeline_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hwlocks_timeline_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= hwlocks_timeline_release,
+};
 
-struct sun6i_hwspinlock_data {
-	struct hwspinlock_device *bank;
-	struct reset_control *reset;
-	struct clk *ahb_clk;
-	struct dentry *debugfs;
-	int nlocks;
+static void sun6i_hwspinlock_debugfs_trace_init(struct sun6i_hwspinlock_data *priv)
+{
+	debugfs_create_file("timeline", 0400, priv->debugfs, priv, &hwlocks_timeline_fops);
+}
+
+#else
+
+static void sun6i_hwspinlock_debugfs_trace_init(struct sun6i_hwspinlock_data *priv)
+{
+}
+
+#endif
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_CALLSITES
+
+struct sun6i_hwspinlock_callsite_report {
+	unsigned long site;
+	u64 acquired;
+	u64 spin_ns;
+	u64 hold_ns;
+	u64 irqoff_ns;
 };
 
-#ifdef CONFIG_DEBUG_FS
+/*
+ * frames of the hwspinlock core, the lock ops of this driver and the exported sun6i_hwspin_*
+ * wrappers (including the rw lock library) are not consumers
+ */
+static const char * const sun6i_hwspinlock_callsite_skip[] = {
+	"__hwspin_",
+	"sun6i_hwspin_",
+	"sun6i_hwspinlock_trylock",
+	"sun6i_hwspinlock_callsite_",
+};
 
-static int hwlocks_supported_show(struct seq_file *seqf, void *unused)
+static bool sun6i_hwspinlock_callsite_skipped(const char *sym)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sun6i_hwspinlock_callsite_skip); ++i) {
+		if (str_has_prefix(sym, sun6i_hwspinlock_callsite_skip[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/* the first recorded frame which is not skipped is the consumer */
+static unsigned long sun6i_hwspinlock_callsite_frame(const struct sun6i_hwspinlock_callsite *site)
+{
+	char sym[KSYM_SYMBOL_LEN];
+	int i;
+
+	for (i = 0; i < SPINLOCK_CALLSITE_DEPTH && site->frames[i]; ++i) {
+		sprint_symbol_no_offset(sym, site->frames[i]);
+		if (!sun6i_hwspinlock_callsite_skipped(sym))
+			return site->frames[i];
+	}
+
+	return site->frames[0];
+}
+
+static int sun6i_hwspinlock_callsite_cmp(const void *a, const void *b)
+{
+	const struct sun6i_hwspinlock_callsite_report *ra = a, *rb = b;
+	u64 ta = ra->spin_ns + ra->hold_ns, tb = rb->spin_ns + rb->hold_ns;
+
+	if (ta == tb)
+		return 0;
+
+	return (ta < tb) ? 1 : -1;
+}
+
+static int hwlocks_callsites_show(struct seq_file *seqf, void *unused)
 {
 	struct sun6i_hwspinlock_data *priv = seqf->private;
+	struct sun6i_hwspinlock_callsite_report *report, *r;
+	struct sun6i_hwspinlock_callsite *site;
+	unsigned long frame;
+	int count = 0, i, j;
 
-	seq_printf(seqf, "%d\n", priv->nlocks);
+	report = kcalloc(SPINLOCK_CALLSITES, sizeof(*report), GFP_KERNEL);
+	if (!report)
+		return -ENOMEM;
+
+	/* different stacks can end in the same consumer, they are summed up here */
+	for (i = 0; i < SPINLOCK_CALLSITES; ++i) {
+		site = &priv->sites[i];
+		/* a freshly claimed slot may not have its frames yet */
+		if (!READ_ONCE(site->key) || !READ_ONCE(site->frames[0]))
+			continue;
+
+		frame = sun6i_hwspinlock_callsite_frame(site);
+		for (j = 0; j < count && report[j].site != frame; ++j)
+			;
+		r = &report[j];
+		if (j == count) {
+			r->site = frame;
+			++count;
+		}
+
+		r->acquired += atomic64_read(&site->acquired);
+		r->spin_ns += atomic64_read(&site->spin_ns);
+		r->hold_ns += atomic64_read(&site->hold_ns);
+		r->irqoff_ns += atomic64_read(&site->irqoff_ns);
+	}
+
+	sort(report, count, sizeof(*report), sun6i_hwspinlock_callsite_cmp, NULL);
+
+	seq_puts(seqf, "# acquired spin_ns hold_ns irqoff_ns site\n");
+	for (i = 0; i < count; ++i)
+		seq_printf(seqf, "%llu %llu %llu %llu %pS\n", report[i].acquired,
+			   report[i].spin_ns, report[i].hold_ns, report[i].irqoff_ns,
+			   (void *)report[i].site);
+	if (atomic_read(&priv->sites_dropped))
+		seq_printf(seqf, "# %d acquisitions dropped, call site table full\n",
+			   atomic_read(&priv->sites_dropped));
+
+	kfree(report);
 
 	return 0;
 }
-DEFINE_SHOW_ATTRIBUTE(hwlocks_supported);
+DEFINE_SHOW_ATTRIBUTE(hwlocks_callsites);
+
+static void sun6i_hwspinlock_debugfs_callsite_init(struct sun6i_hwspinlock_data *priv)
+{
+	debugfs_create_file("callsites", 0400, priv->debugfs, priv, &hwlocks_callsites_fops);
+}
+
+#else
+
+static void sun6i_hwspinlock_debugfs_callsite_init(struct sun6i_hwspinlock_data *priv)
+{
+}
+
+#endif
+
+#ifdef CONFIG_HWSPINLOCK_SUN6I_RECORD
+
+static ssize_t hwlocks_record_read(struct file *file, char __user *buf, size_t count,
+				   loff_t *ppos)
+{
+	struct sun6i_hwspinlock_data *priv = file->private_data;
+	char str[32];
+	int len;
+
+	len = scnprintf(str, sizeof(str), "%d %u\n", READ_ONCE(priv->recording),
+			READ_ONCE(priv->record_count));
+
+	return simple_read_from_buffer(buf, count, ppos, str, len);
+}
+
+static ssize_t hwlocks_record_write(struct file *file, const char __user *buf, size_t count,
+				    loff_t *ppos)
+{
+	struct sun6i_hwspinlock_data *priv = file->private_data;
+	bool enable;
+	int err;
+
+	err = kstrtobool_from_user(buf, count, &enable);
+	if (err)
+		return err;
+
+	mutex_lock(&priv->record_mutex);
+	if (enable)
+		err = sun6i_hwspinlock_record_start(priv);
+	else
+		sun6i_hwspinlock_record_stop(priv);
+	mutex_unlock(&priv->record_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations hwlocks_record_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= hwlocks_record_read,
+	.write	= hwlocks_record_write,
+	.llseek	= default_llseek,
+};
+
+static int hwlocks_recording_open(struct inode *inode, struct file *file)
+{
+	struct sun6i_hwspinlock_data *priv = inode->i_private;
+	struct sun6i_hwspinlock_replay_header *hdr;
+	unsigned long flags;
+	u32 count;
+
+	mutex_lock(&priv->record_mutex);
+	count = priv->records ? READ_ONCE(priv->record_count) : 0;
+	hdr = kvzalloc(sizeof(*hdr) + array_size(count, sizeof(*priv->records)), GFP_KERNEL);
+	if (!hdr) {
+		mutex_unlock(&priv->record_mutex);
+		return -ENOMEM;
+	}
+
+	/*
+	 * the record mutex keeps the recording from being restarted and the count only grows,
+	 * so copying the prefix is safe while the holds of running acquisitions get filled in
+	 */
+	hdr->magic = SUN6I_HWSPINLOCK_REPLAY_MAGIC;
+	hdr->version = SUN6I_HWSPINLOCK_REPLAY_VERSION;
+	if (count) {
+		raw_spin_lock_irqsave(&priv->record_lock, flags);
+		hdr->count = min(count, priv->record_count);
+		raw_spin_unlock_irqrestore(&priv->record_lock, flags);
+		memcpy(hdr + 1, priv->records, array_size(hdr->count, sizeof(*priv->records)));
+	}
+	mutex_unlock(&priv->record_mutex);
+
+	file->private_data = hdr;
+
+	return 0;
+}
+
+static ssize_t hwlocks_recording_read(struct file *file, char __user *buf, size_t count,
+				      loff_t *ppos)
+{
+	struct sun6i_hwspinlock_replay_header *hdr = file->private_data;
+	size_t len;
+
+	len = sizeof(*hdr) + array_size(hdr->count, sizeof(struct sun6i_hwspinlock_replay_record));
+
+	return simple_read_from_buffer(buf, count, ppos, hdr, len);
+}
+
+static int hwlocks_recording_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations hwlocks_recording_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hwlocks_recording_open,
+	.read		= hwlocks_recording_read,
+	.llseek		= default_llseek,
+	.release	= hwlocks_recording_release,
+};
+
+static void sun6i_hwspinlock_debugfs_record_init(struct sun6i_hwspinlock_data *priv)
+{
+	debugfs_create_file("record", 0600, priv->debugfs, priv, &hwlocks_record_fops);
+	debugfs_create_file("recording", 0400, priv->debugfs, priv, &hwlocks_recording_fops);
+}
+
+#else
+
+static void sun6i_hwspinlock_debugfs_record_init(struct sun6i_hwspinlock_data *priv)
+{
+}
+
+#endif
+
+static int hwlocks_leases_show(struct seq_file *seqf, void *unused)
+{
+	struct sun6i_hwspinlock_data *priv = seqf->private;
+	struct sun6i_hwspinlock_lock *hwl;
+	int i;
+
+	seq_printf(seqf, "# policy %s\n", sun6i_hwspinlock_lease_policies[priv->lease_policy]);
+	seq_puts(seqf, "# lock budget_us expiries expired\n");
+	for (i = 0; i < min(priv->nlocks, SPINLOCK_LEASE_LOCKS); ++i) {
+		hwl = &priv->locks[i];
+		if (READ_ONCE(hwl->lease_us))
+			seq_printf(seqf, "%d %u %lu %d\n", i, READ_ONCE(hwl->lease_us),
+				   hwl->lease_expiries, READ_ONCE(hwl->lease_expired));
+	}
+
+	return 0;
+}
+
+static int hwlocks_leases_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hwlocks_leases_show, inode->i_private);
+}
+
+/* "<lock> <budget in us>" sets a lease, a budget of 0 removes it, "<policy>" sets the policy */
+static ssize_t hwlocks_leases_write(struct file *file, const char __user *buf, size_t count,
+				    loff_t *ppos)
+{
+	struct sun6i_hwspinlock_data *priv = ((struct seq_file *)file->private_data)->private;
+	char str[32];
+	u32 budget;
+	int id, err;
+
+	if (count >= sizeof(str))
+		return -EINVAL;
+	if (copy_from_user(str, buf, count))
+		return -EFAULT;
+	str[count] = '\0';
+
+	if (sscanf(str, "%d %u", &id, &budget) == 2) {
+		err = sun6i_hwspinlock_lease_set(priv, id, budget);
+		if (err)
+			return err;
+	} else {
+		err = sysfs_match_string(sun6i_hwspinlock_lease_policies, str);
+		if (err < 0)
+			return err;
+		WRITE_ONCE(priv->lease_policy, err);
+	}
+
+	return count;
+}
+
+static const struct file_operations hwlocks_leases_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hwlocks_leases_open,
+	.read		= seq_read,
+	.write		= hwlocks_leases_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int hwlocks_quotas_show(struct seq_file *seqf, void *unused)
+{
+	struct sun6i_hwspinlock_data *priv = seqf->private;
+	struct sun6i_hwspinlock_lock *hwl;
+	int i;
+
+	seq_printf(seqf, "# default yield %llu ns\n", priv->quota_yield_ns);
+	seq_puts(seqf, "# lock burst share window_us yield_us throttled yielded\n");
+	for (i = 0; i < priv->nlocks; ++i) {
+		hwl = &priv->locks[i];
+		if (!sun6i_hwspinlock_quota_enabled(hwl) && !hwl->quota_throttled)
+			continue;
+
+		seq_printf(seqf, "%d %u %u %llu %llu %lu %lu\n", i, READ_ONCE(hwl->quota_burst),
+			   READ_ONCE(hwl->quota_share),
+			   div_u64(READ_ONCE(hwl->quota_window_ns), NSEC_PER_USEC),
+			   div_u64(READ_ONCE(hwl->quota_yield_ns), NSEC_PER_USEC),
+			   READ_ONCE(hwl->quota_throttled), READ_ONCE(hwl->quota_yielded));
+	}
+
+	return 0;
+}
+
+static int hwlocks_quotas_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hwlocks_quotas_show, inode->i_private);
+}
+
+/* "<lock> <burst> <share> <window in us> [<yield in us>]", a yield of 0 uses the default */
+static ssize_t hwlocks_quotas_write(struct file *file, const char __user *buf, size_t count,
+				    loff_t *ppos)
+{
+	struct sun6i_hwspinlock_data *priv = ((struct seq_file *)file->private_data)->private;
+	u32 burst, share, window_us, yield_us = 0;
+	char str[64];
+	int id, err;
+
+	if (count >= sizeof(str))
+		return -EINVAL;
+	if (copy_from_user(str, buf, count))
+		return -EFAULT;
+	str[count] = '\0';
+
+	if (sscanf(str, "%d %u %u %u %u", &id, &burst, &share, &window_us, &yield_us) < 4)
+		return -EINVAL;
+
+	err = sun6i_hwspinlock_quota_set(priv, id, burst, share, window_us, yield_us);
+
+	return err ? err : count;
+}
+
+static const struct file_operations hwlocks_quotas_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hwlocks_quotas_open,
+	.read		= seq_read,
+	.write		= hwlocks_quotas_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* a pid of 0 means the lock was taken outside of task context */
+static int hwlocks_owners_show(struct seq_file *seqf, void *unused)
+{
+	struct sun6i_hwspinlock_data *priv = seqf->private;
+	struct sun6i_hwspinlock_owner *owner;
+	u64 now = local_clock(), since;
+	int i;
+
+	seq_puts(seqf, "# lock pid cpu depth age_us\n");
+	for (i = 0; i < priv->nlocks; ++i) {
+		owner = &priv->locks[i].owner;
+		if (!smp_load_acquire(&owner->held))
+			continue;
+
+		since = READ_ONCE(owner->since);
+		seq_printf(seqf, "%d %d %d %u %llu\n", i, READ_ONCE(owner->pid),
+			   READ_ONCE(owner->cpu), READ_ONCE(owner->depth),
+			   now > since ? div_u64(now - since, NSEC_PER_USEC) : 0);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hwlocks_owners);
 
 static void sun6i_hwspinlock_debugfs_init(struct sun6i_hwspinlock_data *priv)
 {
 	priv->debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
 	debugfs_create_file("supported", 0444, priv->debugfs, priv, &hwlocks_supported_fops);
+	debugfs_create_file("leases", 0600, priv->debugfs, priv, &hwlocks_leases_fops);
+	debugfs_create_file("quotas", 0600, priv->debugfs, priv, &hwlocks_quotas_fops);
+	debugfs_create_file("owners", 0400, priv->debugfs, priv, &hwlocks_owners_fops);
+	sun6i_hwspinlock_debugfs_trace_init(priv);
+	sun6i_hwspinlock_debugfs_callsite_init(priv);
+	sun6i_hwspinlock_debugfs_record_init(priv);
 }
 
 #else
@@ -62,47 +1606,301 @@ static void sun6i_hwspinlock_debugfs_init(struct sun6i_hwspinlock_data *priv)
 
 static int sun6i_hwspinlock_trylock(struct hwspinlock *lock)
 {
-	void __iomem *lock_addr = lock->priv;
+	struct sun6i_hwspinlock_lock *hwl = lock->priv;
+	bool quota = sun6i_hwspinlock_quota_enabled(hwl);
+	unsigned long flags;
+	int taken = 0;
+
+	/* an attempt refused by the quota is a failed attempt for the statistics too */
+	raw_spin_lock_irqsave(&hwl->state_lock, flags);
+	if (!quota || !sun6i_hwspinlock_quota_yield(hwl)) {
+		taken = (sun6i_hwspinlock_read(hwl) == SPINLOCK_NOTTAKEN);
+		if (taken)
+			sun6i_hwspinlock_owner_set(hwl);
+		if (quota)
+			sun6i_hwspinlock_quota_trylock(hwl, taken);
+	}
+	sun6i_hwspinlock_trace_trylock(hwl, taken);
+	sun6i_hwspinlock_callsite_trylock(hwl, taken);
+	sun6i_hwspinlock_record_trylock(hwl, taken);
+	raw_spin_unlock_irqrestore(&hwl->state_lock, flags);
 
-	return (readl(lock_addr) == SPINLOCK_NOTTAKEN);
+	return taken;
 }
 
 static void sun6i_hwspinlock_unlock(struct hwspinlock *lock)
 {
-	void __iomem *lock_addr = lock->priv;
+	struct sun6i_hwspinlock_lock *hwl = lock->priv;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&hwl->state_lock, flags);
+	sun6i_hwspinlock_trace_unlock(hwl);
+	sun6i_hwspinlock_callsite_unlock(hwl);
+	sun6i_hwspinlock_record_unlock(hwl);
+	if (sun6i_hwspinlock_quota_enabled(hwl))
+		sun6i_hwspinlock_quota_unlock(hwl);
+	sun6i_hwspinlock_owner_clear(hwl);
+	sun6i_hwspinlock_write(hwl, SPINLOCK_NOTTAKEN);
+	raw_spin_unlock_irqrestore(&hwl->state_lock, flags);
+}
+
+/* the core keeps spinning until the timeout and can not be told about a self-deadlock */
+static void sun6i_hwspinlock_relax(struct hwspinlock *lock)
+{
+	struct sun6i_hwspinlock_lock *hwl = lock->priv;
 
-	writel(SPINLOCK_NOTTAKEN, lock_addr);
+	WARN_ONCE(sun6i_hwspinlock_owned(hwl), "hwlock %d already held by this context\n",
+		  hwl->id);
 }
 
 static const struct hwspinlock_ops sun6i_hwspinlock_ops = {
 	.trylock	= sun6i_hwspinlock_trylock,
 	.unlock		= sun6i_hwspinlock_unlock,
+	.relax		= sun6i_hwspinlock_relax,
 };
 
+/**
+ * sun6i_hwspin_lock_held_by_me() - check if the calling context holds a hwspinlock
+ * @hwlock: the hwspinlock to be checked
+ *
+ * Answered from the software shadow, without touching the lock register. Outside of task
+ * context, any hold taken outside of task context on the same cpu counts as held by me.
+ *
+ * Returns true if the calling context took @hwlock and did not release it yet.
+ */
+bool sun6i_hwspin_lock_held_by_me(struct hwspinlock *hwlock)
+{
+	if (hwlock->bank->ops != &sun6i_hwspinlock_ops)
+		return false;
+
+	return sun6i_hwspinlock_owned(hwlock->priv);
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_lock_held_by_me);
+
+/**
+ * sun6i_hwspin_lock_held_by_linux() - check if any Linux user holds a hwspinlock
+ * @hwlock: the hwspinlock to be checked
+ *
+ * Answered from the software shadow, without touching the lock register, so a hold of the
+ * companion core is not visible here.
+ *
+ * Returns true if a Linux user took @hwlock and did not release it yet.
+ */
+bool sun6i_hwspin_lock_held_by_linux(struct hwspinlock *hwlock)
+{
+	struct sun6i_hwspinlock_lock *hwl = hwlock->priv;
+
+	if (hwlock->bank->ops != &sun6i_hwspinlock_ops)
+		return false;
+
+	return READ_ONCE(hwl->owner.held);
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_lock_held_by_linux);
+
+/**
+ * sun6i_hwspin_lock_timeout() - lock a hwspinlock with timeout limit
+ * @hwlock: the hwspinlock to be locked
+ * @to: timeout value in msecs
+ *
+ * Works like hwspin_lock_timeout(), but gives up as soon as the watchdog found the remote
+ * holder exceeding its lease, instead of spinning until the timeout.
+ *
+ * Returns 0 when the @hwlock was successfully taken, -EDEADLK if the calling context already
+ * holds it, -EOWNERDEAD if the remote holder exceeded its lease and -ETIMEDOUT if the @hwlock
+ * is still busy after @to msecs.
+ */
+int sun6i_hwspin_lock_timeout(struct hwspinlock *hwlock, unsigned int to)
+{
+	unsigned long expire = jiffies + msecs_to_jiffies(to);
+	int ret;
+
+	if (hwlock->bank->ops != &sun6i_hwspinlock_ops)
+		return hwspin_lock_timeout(hwlock, to);
+
+	ret = sun6i_hwspinlock_deadlock_check(hwlock->priv);
+	if (ret)
+		return ret;
+
+	for (;;) {
+		ret = hwspin_trylock(hwlock);
+		if (ret != -EBUSY)
+			return ret;
+
+		ret = sun6i_hwspinlock_lease_check(hwlock->priv);
+		if (ret)
+			return ret;
+
+		if (time_is_before_eq_jiffies(expire))
+			return -ETIMEDOUT;
+
+		cpu_relax();
+	}
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_lock_timeout);
+
+/* waiters are ordered by priority (lower value first, like task priorities), then deadline */
+static void sun6i_hwspinlock_waiter_add(struct sun6i_hwspinlock_lock *hwl,
+					struct sun6i_hwspinlock_waiter *waiter)
+{
+	struct sun6i_hwspinlock_waiter *pos;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&hwl->waiters_lock, flags);
+	list_for_each_entry(pos, &hwl->waiters, node) {
+		if (waiter->prio < pos->prio ||
+		    (waiter->prio == pos->prio && ktime_before(waiter->deadline, pos->deadline)))
+			break;
+	}
+	list_add_tail(&waiter->node, &pos->node);
+	WRITE_ONCE(hwl->waiter_head, list_first_entry(&hwl->waiters,
+						      struct sun6i_hwspinlock_waiter, node));
+	WRITE_ONCE(hwl->waiter_polled, ktime_get_ns());
+	raw_spin_unlock_irqrestore(&hwl->waiters_lock, flags);
+}
+
+static void sun6i_hwspinlock_waiter_del(struct sun6i_hwspinlock_lock *hwl,
+					struct sun6i_hwspinlock_waiter *waiter)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&hwl->waiters_lock, flags);
+	list_del(&waiter->node);
+	WRITE_ONCE(hwl->waiter_head, list_first_entry_or_null(&hwl->waiters,
+							      struct sun6i_hwspinlock_waiter, node));
+	WRITE_ONCE(hwl->waiter_polled, ktime_get_ns());
+	raw_spin_unlock_irqrestore(&hwl->waiters_lock, flags);
+}
+
+/* an interrupted head waiter does not poll, the other waiters take over after a short while */
+static bool sun6i_hwspinlock_waiter_stale(struct sun6i_hwspinlock_lock *hwl, ktime_t now)
+{
+	return ktime_to_ns(now) - READ_ONCE(hwl->waiter_polled) > SPINLOCK_WAITER_STALE;
+}
+
+/**
+ * sun6i_hwspin_lock_deadline() - lock a hwspinlock before an absolute deadline
+ * @hwlock: the hwspinlock to be locked
+ * @deadline: absolute CLOCK_MONOTONIC time the lock has to be taken by
+ * @prio: priority of the caller, lower values are more important (like task priorities)
+ * @slack_ns: if not NULL, set to the time left until @deadline on success
+ *
+ * Linux users waiting through this function for the same @hwlock are queued by @prio and
+ * then by @deadline, only the first one polls the lock register, so the most urgent waiter
+ * gets the lock as soon as it is free and the others keep off the bus. The first waiter runs
+ * with preemption disabled, if it is held up by interrupts anyway, the others poll too until
+ * it is back. Users of the plain hwspin_lock_*() functions are not queued and still compete
+ * with the first waiter. The lock is taken like hwspin_trylock() does and has to be released
+ * by hwspin_unlock().
+ *
+ * Returns 0 when the @hwlock was successfully taken, -EDEADLK if the calling context already
+ * holds it, -EOWNERDEAD if the remote holder exceeded its lease and -ETIMEDOUT if the @hwlock
+ * was not taken before @deadline. The slack may be negative, if the lock was taken by the
+ * final attempt after @deadline.
+ */
+int sun6i_hwspin_lock_deadline(struct hwspinlock *hwlock, ktime_t deadline, int prio,
+			       s64 *slack_ns)
+{
+	struct sun6i_hwspinlock_waiter waiter = { .deadline = deadline, .prio = prio };
+	bool queued = hwlock->bank->ops == &sun6i_hwspinlock_ops;
+	struct sun6i_hwspinlock_lock *hwl = hwlock->priv;
+	bool head = false, poll = true;
+	ktime_t now;
+	int ret;
+
+	if (queued) {
+		ret = sun6i_hwspinlock_deadlock_check(hwl);
+		if (ret)
+			return ret;
+
+		sun6i_hwspinlock_waiter_add(hwl, &waiter);
+	}
+
+	for (;;) {
+		now = ktime_get();
+		if (queued) {
+			/* nobody polls for a preempted head waiter, so it must not be preempted */
+			if ((READ_ONCE(hwl->waiter_head) == &waiter) != head) {
+				head = !head;
+				if (head)
+					preempt_disable();
+				else
+					preempt_enable();
+			}
+
+			poll = head || sun6i_hwspinlock_waiter_stale(hwl, now);
+			if (head)
+				WRITE_ONCE(hwl->waiter_polled, ktime_to_ns(now));
+		}
+
+		if (poll) {
+			ret = hwspin_trylock(hwlock);
+			if (ret != -EBUSY)
+				break;
+		}
+
+		if (queued) {
+			ret = sun6i_hwspinlock_lease_check(hwl);
+			if (ret)
+				break;
+		}
+
+		if (ktime_after(now, deadline)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		cpu_relax();
+	}
+
+	/* a successful hwspin_trylock() disabled preemption on its own */
+	if (queued) {
+		sun6i_hwspinlock_waiter_del(hwl, &waiter);
+		if (head)
+			preempt_enable();
+	}
+
+	if (!ret && slack_ns)
+		*slack_ns = ktime_to_ns(ktime_sub(deadline, ktime_get()));
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_lock_deadline);
+
 static void sun6i_hwspinlock_disable(void *data)
 {
 	struct sun6i_hwspinlock_data *priv = data;
 
 	debugfs_remove_recursive(priv->debugfs);
+	cancel_delayed_work_sync(&priv->lease_work);
+	sun6i_hwspinlock_record_free(priv);
 	clk_disable_unprepare(priv->ahb_clk);
 	reset_control_assert(priv->reset);
 }
 
 static int sun6i_hwspinlock_probe(struct platform_device *pdev)
 {
+	const struct sun6i_hwspinlock_emu *emu;
 	struct sun6i_hwspinlock_data *priv;
 	struct hwspinlock *hwlock;
 	void __iomem *io_base;
 	u32 num_banks;
 	int err, i;
 
-	io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
+	/* the emulated device brings its own register page */
+	emu = dev_get_platdata(&pdev->dev);
+	if (emu)
+		io_base = emu->base;
+	else
+		io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
 	if (IS_ERR(io_base))
 		return PTR_ERR(io_base);
 
 	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
+	priv->dev = &pdev->dev;
+	priv->io_base = io_base;
+	priv->emu = emu;
 
 	priv->ahb_clk = devm_clk_get(&pdev->dev, "ahb");
 	if (IS_ERR(priv->ahb_clk)) {
@@ -161,9 +1959,53 @@ static int sun6i_hwspinlock_probe(struct platform_device *pdev)
 		goto bank_fail;
 	}
 
+	priv->locks = devm_kcalloc(&pdev->dev, priv->nlocks, sizeof(*priv->locks), GFP_KERNEL);
+	if (!priv->locks) {
+		err = -ENOMEM;
+		goto bank_fail;
+	}
+
+	priv->held = devm_alloc_percpu(&pdev->dev, atomic_t);
+	if (!priv->held) {
+		err = -ENOMEM;
+		goto bank_fail;
+	}
+
 	for (i = 0; i < priv->nlocks; ++i) {
+		priv->locks[i].priv = priv;
+		priv->locks[i].reg = io_base + SPINLOCK_LOCK_REGN + sizeof(u32) * i;
+		priv->locks[i].id = i;
+		raw_spin_lock_init(&priv->locks[i].state_lock);
+		raw_spin_lock_init(&priv->locks[i].waiters_lock);
+		INIT_LIST_HEAD(&priv->locks[i].waiters);
 		hwlock = &priv->bank->lock[i];
-		hwlock->priv = io_base + SPINLOCK_LOCK_REGN + sizeof(u32) * i;
+		hwlock->priv = &priv->locks[i];
+	}
+
+	err = sun6i_hwspinlock_trace_init(pdev, priv);
+	if (err) {
+		dev_err(&pdev->dev, "unable to setup lock tracing (%d)\n", err);
+		goto bank_fail;
+	}
+
+	err = sun6i_hwspinlock_callsite_init(pdev, priv);
+	if (err) {
+		dev_err(&pdev->dev, "unable to setup call site statistics (%d)\n", err);
+		goto bank_fail;
+	}
+
+	sun6i_hwspinlock_record_init(priv);
+
+	err = sun6i_hwspinlock_lease_init(pdev, priv);
+	if (err) {
+		dev_err(&pdev->dev, "invalid lease setup (%d)\n", err);
+		goto bank_fail;
+	}
+
+	err = sun6i_hwspinlock_quota_init(pdev, priv);
+	if (err) {
+		dev_err(&pdev->dev, "invalid quota setup (%d)\n", err);
+		goto bank_fail;
 	}
 
 	/* failure of debugfs is considered non-fatal */
@@ -179,8 +2021,14 @@ static int sun6i_hwspinlock_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, priv);
 
-	return devm_hwspin_lock_register(&pdev->dev, priv->bank, &sun6i_hwspinlock_ops,
-					 SPINLOCK_BASE_ID, priv->nlocks);
+	err = devm_hwspin_lock_register(&pdev->dev, priv->bank, &sun6i_hwspinlock_ops,
+					SPINLOCK_BASE_ID, priv->nlocks);
+	if (err)
+		return err;
+
+	sun6i_hwspinlock_lease_start(priv);
+
+	return 0;
 
 bank_fail:
 	clk_disable_unprepare(priv->ahb_clk);
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * sun6i_hwspinlock.h - sun6i hardware spinlock driver extensions
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ */
+
+#ifndef SUN6I_HWSPINLOCK_H
+#define SUN6I_HWSPINLOCK_H
+
+#include <linux/hwspinlock.h>
+#include <linux/ktime.h>
+
+#include "sun6i_hwspinlock_rw.h"
+
+struct sun6i_hwspinlock_rwlock {
+	struct hwspinlock *guard;
+	volatile struct sun6i_hwspinlock_rw_shared *shared;
+};
+
+#if IS_ENABLED(CONFIG_HWSPINLOCK_SUN6I)
+
+int sun6i_hwspin_lock_timeout(struct hwspinlock *hwlock, unsigned int to);
+int sun6i_hwspin_lock_deadline(struct hwspinlock *hwlock, ktime_t deadline, int prio,
+			       s64 *slack_ns);
+bool sun6i_hwspin_lock_held_by_me(struct hwspinlock *hwlock);
+bool sun6i_hwspin_lock_held_by_linux(struct hwspinlock *hwlock);
+
+#else
+
+static inline int sun6i_hwspin_lock_timeout(struct hwspinlock *hwlock, unsigned int to)
+{
+	return hwspin_lock_timeout(hwlock, to);
+}
+
+static inline int sun6i_hwspin_lock_deadline(struct hwspinlock *hwlock, ktime_t deadline,
+					     int prio, s64 *slack_ns)
+{
+	int ret;
+
+	while ((ret = hwspin_trylock(hwlock)) == -EBUSY) {
+		if (ktime_after(ktime_get(), deadline))
+			return -ETIMEDOUT;
+		cpu_relax();
+	}
+
+	if (!ret && slack_ns)
+		*slack_ns = ktime_to_ns(ktime_sub(deadline, ktime_get()));
+
+	return ret;
+}
+
+static inline bool sun6i_hwspin_lock_held_by_me(struct hwspinlock *hwlock)
+{
+	return false;
+}
+
+static inline bool sun6i_hwspin_lock_held_by_linux(struct hwspinlock *hwlock)
+{
+	return false;
+}
+
+#endif
+
+#if IS_ENABLED(CONFIG_HWSPINLOCK_SUN6I_RW)
+
+void sun6i_hwspin_rwlock_init(struct sun6i_hwspinlock_rwlock *rw, struct hwspinlock *guard,
+			      struct sun6i_hwspinlock_rw_shared *shared);
+int sun6i_hwspin_read_lock(struct sun6i_hwspinlock_rwlock *rw, unsigned int to);
+void sun6i_hwspin_read_unlock(struct sun6i_hwspinlock_rwlock *rw);
+int sun6i_hwspin_write_lock(struct sun6i_hwspinlock_rwlock *rw, unsigned int to);
+void sun6i_hwspin_write_unlock(struct sun6i_hwspinlock_rwlock *rw);
+
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * sun6i_hwspinlock_emu.h - platform data of the emulated sun6i hwspinlock device
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * The emulated device has no MMIO range, but a register page in normal memory. Reads of the
+ * lock registers have test-and-set side effects, which plain memory can not provide, so lock
+ * register accesses go through the read and write callbacks. Everything else (SYSSTATUS and
+ * the live SPINLOCK_STATUS bitmap) can be read directly from the page.
+ */
+
+#ifndef SUN6I_HWSPINLOCK_EMU_H
+#define SUN6I_HWSPINLOCK_EMU_H
+
+#include <linux/types.h>
+
+struct sun6i_hwspinlock_emu {
+	void __iomem *base;
+	u32 (*read)(const struct sun6i_hwspinlock_emu *emu, void __iomem *addr);
+	void (*write)(const struct sun6i_hwspinlock_emu *emu, u32 val, void __iomem *addr);
+	void *priv;
+};
+
+#endif
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * sun6i_hwspinlock_replay.h - lock traffic recording format for sun6i hwspinlock users
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * This header is shared by the Linux driver, the replay test module and userspace tools. A
+ * recording is a header followed by count records in the order the locks were taken. The gap
+ * is the time from the latest arrival (first lock attempt) of any earlier record to the
+ * arrival of this one, a waiter which arrived before that but took its lock later gets a gap
+ * of 0. The hold is 0 if the lock was not released yet when the recording was read out, or
+ * the recording was restarted meanwhile. Both times saturate at UINT32_MAX ns.
+ */
+
+#ifndef SUN6I_HWSPINLOCK_REPLAY_H
+#define SUN6I_HWSPINLOCK_REPLAY_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define SUN6I_HWSPINLOCK_REPLAY_MAGIC	0x524c5748 /* "HWLR" */
+#define SUN6I_HWSPINLOCK_REPLAY_VERSION	1
+
+struct sun6i_hwspinlock_replay_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct sun6i_hwspinlock_replay_record {
+	uint32_t gap_ns;
+	uint32_t hold_ns;
+	uint8_t lock;
+	uint8_t cpu;
+	uint16_t reserved;
+};
+
+#endif
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sun6i_hwspinlock_rw.c - reader-writer lock across ARM cores and companion core
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ */
+
+#include <linux/bug.h>
+#include <linux/errno.h>
+#include <linux/hwspinlock.h>
+#include <linux/jiffies.h>
+#include <linux/module.h>
+#include <linux/types.h>
+
+#include "sun6i_hwspinlock.h"
+#include "sun6i_hwspinlock_rw.h"
+
+#define SPINLOCK_RW_GUARD_TIMEOUT	100 /* ms */
+
+/* the guard is always taken for at least one attempt, even if the timeout already passed */
+static int sun6i_hwspin_rw_guard(struct sun6i_hwspinlock_rwlock *rw, unsigned long expire)
+{
+	unsigned int to = 0;
+
+	if (time_before(jiffies, expire))
+		to = jiffies_to_msecs(expire - jiffies);
+
+	return hwspin_lock_timeout(rw->guard, to);
+}
+
+/* returns -ETIMEDOUT if the state still blocks after the timeout, the guard is not taken */
+static int sun6i_hwspin_rw_wait(struct sun6i_hwspinlock_rwlock *rw, unsigned long expire,
+				int (*blocked)(volatile struct sun6i_hwspinlock_rw_shared *rw))
+{
+	while (blocked(rw->shared)) {
+		if (time_is_before_eq_jiffies(expire))
+			return -ETIMEDOUT;
+
+		cpu_relax();
+	}
+
+	return 0;
+}
+
+/* leaving the lock must not fail, so the guard is retried until it can be taken */
+static void sun6i_hwspin_rw_guard_forced(struct sun6i_hwspinlock_rwlock *rw)
+{
+	while (hwspin_lock_timeout(rw->guard, SPINLOCK_RW_GUARD_TIMEOUT))
+		WARN_ONCE(1, "hwspinlock rw guard %d stuck\n", hwspin_lock_get_id(rw->guard));
+}
+
+/**
+ * sun6i_hwspin_rwlock_init() - initialize a reader-writer lock
+ * @rw: the reader-writer lock
+ * @guard: the hwspinlock protecting the shared state
+ * @shared: the shared state, mapped uncached in memory both sides can access
+ *
+ * Only the side which owns the shared state first should clear it, the companion core may
+ * already use it.
+ */
+void sun6i_hwspin_rwlock_init(struct sun6i_hwspinlock_rwlock *rw, struct hwspinlock *guard,
+			      struct sun6i_hwspinlock_rw_shared *shared)
+{
+	rw->guard = guard;
+	rw->shared = shared;
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_rwlock_init);
+
+/**
+ * sun6i_hwspin_read_lock() - enter a reader-writer lock as reader
+ * @rw: the reader-writer lock
+ * @to: timeout value in msecs
+ *
+ * Readers do not hold the guard hwlock while inside the critical section, so the caller may
+ * sleep there. A blocked reader waits for the writers without the guard and only takes it
+ * again once they are gone. Returns 0 on success and -ETIMEDOUT if a writer kept the lock
+ * for @to msecs.
+ */
+int sun6i_hwspin_read_lock(struct sun6i_hwspinlock_rwlock *rw, unsigned int to)
+{
+	unsigned long expire = jiffies + msecs_to_jiffies(to);
+	int ret, entered;
+
+	for (;;) {
+		ret = sun6i_hwspin_rw_wait(rw, expire, sun6i_hwspinlock_rw_read_blocked);
+		if (ret)
+			return ret;
+
+		ret = sun6i_hwspin_rw_guard(rw, expire);
+		if (ret)
+			return ret;
+
+		entered = sun6i_hwspinlock_rw_read_enter(rw->shared);
+		hwspin_unlock(rw->guard);
+		if (entered)
+			return 0;
+
+		if (time_is_before_eq_jiffies(expire))
+			return -ETIMEDOUT;
+	}
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_read_lock);
+
+/**
+ * sun6i_hwspin_read_unlock() - leave a reader-writer lock as reader
+ * @rw: the reader-writer lock
+ */
+void sun6i_hwspin_read_unlock(struct sun6i_hwspinlock_rwlock *rw)
+{
+	sun6i_hwspin_rw_guard_forced(rw);
+	sun6i_hwspinlock_rw_read_leave(rw->shared);
+	hwspin_unlock(rw->guard);
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_read_unlock);
+
+/**
+ * sun6i_hwspin_write_lock() - enter a reader-writer lock as writer
+ * @rw: the reader-writer lock
+ * @to: timeout value in msecs
+ *
+ * The writer intent is announced first, which keeps new readers out while the current ones
+ * leave. Returns 0 on success and -ETIMEDOUT if the lock could not be taken within @to msecs.
+ */
+int sun6i_hwspin_write_lock(struct sun6i_hwspinlock_rwlock *rw, unsigned int to)
+{
+	unsigned long expire = jiffies + msecs_to_jiffies(to);
+	int ret, entered;
+
+	ret = sun6i_hwspin_rw_guard(rw, expire);
+	if (ret)
+		return ret;
+
+	sun6i_hwspinlock_rw_write_intent(rw->shared);
+	hwspin_unlock(rw->guard);
+
+	for (;;) {
+		ret = sun6i_hwspin_rw_wait(rw, expire, sun6i_hwspinlock_rw_write_blocked);
+		if (!ret)
+			ret = sun6i_hwspin_rw_guard(rw, expire);
+		if (!ret) {
+			entered = sun6i_hwspinlock_rw_write_enter(rw->shared);
+			hwspin_unlock(rw->guard);
+			if (entered)
+				return 0;
+
+			ret = time_is_before_eq_jiffies(expire) ? -ETIMEDOUT : 0;
+		}
+
+		/* a writer giving up has to withdraw its intent, or readers would be blocked */
+		if (ret) {
+			sun6i_hwspin_rw_guard_forced(rw);
+			sun6i_hwspinlock_rw_write_cancel(rw->shared);
+			hwspin_unlock(rw->guard);
+			return ret;
+		}
+	}
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_write_lock);
+
+/**
+ * sun6i_hwspin_write_unlock() - leave a reader-writer lock as writer
+ * @rw: the reader-writer lock
+ */
+void sun6i_hwspin_write_unlock(struct sun6i_hwspinlock_rwlock *rw)
+{
+	sun6i_hwspin_rw_guard_forced(rw);
+	sun6i_hwspinlock_rw_write_leave(rw->shared);
+	hwspin_unlock(rw->guard);
+}
+EXPORT_SYMBOL_GPL(sun6i_hwspin_write_unlock);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SUN6I hardware spinlock reader-writer lock");
+MODULE_AUTHOR("Wilken Gottwalt <wilken.gottwalt@posteo.net>");
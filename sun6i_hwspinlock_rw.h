@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * sun6i_hwspinlock_rw.h - shared memory reader-writer lock protocol for sun6i hwspinlock users
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * This header is shared by the Linux side and the companion core firmware, so it must not
+ * depend on anything besides the fixed size integer types. The lock state lives in memory
+ * both sides see uncached and is protected by a guard hwlock, every helper below besides the
+ * *_blocked() ones has to be called with the guard taken. Readers and writers only hold the
+ * guard while entering or leaving, so readers run in parallel. A waiting writer keeps new
+ * readers out (writer preference), which keeps a writing firmware from starving behind a
+ * stream of ARM readers.
+ *
+ * reader: wait while read_blocked, take guard, read_enter, release guard, retry until it
+ *         returned 1
+ * writer: take guard, write_intent, release guard,
+ *         wait while write_blocked, take guard, write_enter, release guard, retry until it
+ *         returned 1 (a writer giving up has to call write_cancel with the guard taken)
+ *
+ * Waiting without the guard keeps blocked users from hammering it, so the side which can enter
+ * (often the slower companion core) wins the guard without racing a crowd of pollers.
+ */
+
+#ifndef SUN6I_HWSPINLOCK_RW_H
+#define SUN6I_HWSPINLOCK_RW_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+struct sun6i_hwspinlock_rw_shared {
+	uint32_t readers;	/* readers inside the critical section */
+	uint32_t writers;	/* waiting writers, no new readers while set */
+	uint32_t writer;	/* a writer is inside the critical section */
+	uint32_t reserved;
+};
+
+static inline int sun6i_hwspinlock_rw_read_enter(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	if (rw->writers || rw->writer)
+		return 0;
+
+	rw->readers++;
+
+	return 1;
+}
+
+/* only a hint, may be called without the guard */
+static inline int sun6i_hwspinlock_rw_read_blocked(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	return rw->writers || rw->writer;
+}
+
+static inline void sun6i_hwspinlock_rw_read_leave(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	rw->readers--;
+}
+
+static inline void sun6i_hwspinlock_rw_write_intent(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	rw->writers++;
+}
+
+static inline void sun6i_hwspinlock_rw_write_cancel(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	rw->writers--;
+}
+
+/* only a hint, may be called without the guard */
+static inline int sun6i_hwspinlock_rw_write_blocked(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	return rw->readers || rw->writer;
+}
+
+static inline int sun6i_hwspinlock_rw_write_enter(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	if (rw->readers || rw->writer)
+		return 0;
+
+	rw->writer = 1;
+	rw->writers--;
+
+	return 1;
+}
+
+static inline void sun6i_hwspinlock_rw_write_leave(volatile struct sun6i_hwspinlock_rw_shared *rw)
+{
+	rw->writer = 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * sun6i_hwspinlock_trace.h - shared memory trace ring format for sun6i hwspinlock users
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * This header is shared by the Linux driver, the companion core firmware and userspace tools,
+ * so it must not depend on anything besides the fixed size integer types.
+ *
+ * A ring has exactly one producer. The producer fills the entry at (head & (size - 1)) and
+ * increments head afterwards with release semantics. A producer (re)initialising a ring clears
+ * the magic first and sets it again last. Readers take a snapshot of head, copy the entries
+ * and drop everything which got overwritten while copying. Every stamp is a value
+ * of the architected system counter, which is readable by the ARM cores and the companion core.
+ */
+
+#ifndef SUN6I_HWSPINLOCK_TRACE_H
+#define SUN6I_HWSPINLOCK_TRACE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define SUN6I_HWSPINLOCK_TRACE_MAGIC	0x544c5748 /* "HWLT" */
+#define SUN6I_HWSPINLOCK_TRACE_VERSION	1
+
+/* side which produced an event */
+#define SUN6I_HWSPINLOCK_TRACE_LINUX	0
+#define SUN6I_HWSPINLOCK_TRACE_FIRMWARE	1
+#define SUN6I_HWSPINLOCK_TRACE_NONE	0xff
+
+/*
+ * events, SPIN is only logged once when a side starts to wait for a lock, TAKEN is logged
+ * after the lock register was read as not taken and RELEASED right before it gets cleared
+ */
+#define SUN6I_HWSPINLOCK_TRACE_SPIN	1
+#define SUN6I_HWSPINLOCK_TRACE_TAKEN	2
+#define SUN6I_HWSPINLOCK_TRACE_RELEASED	3
+
+struct sun6i_hwspinlock_trace_entry {
+	uint64_t stamp;
+	uint8_t lock;
+	uint8_t event;
+	uint8_t side;
+	uint8_t cpu;
+	uint32_t reserved;
+};
+
+struct sun6i_hwspinlock_trace_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* number of entries, power of two */
+	uint32_t rate;		/* system counter frequency in Hz */
+	uint32_t head;		/* free running write index */
+	uint32_t reserved[3];
+	struct sun6i_hwspinlock_trace_entry entries[];
+};
+
+#endif
@@ -4,16 +4,26 @@
  * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
  */
 
+#include <linux/bitmap.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/errno.h>
+#include <linux/firmware.h>
 #include <linux/hwspinlock.h>
 #include <linux/init.h>
 #include <linux/io.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of.h>
+#include <linux/platform_device.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timekeeping.h>
+
+#include "../sun6i_hwspinlock_replay.h"
 
 #define DRIVER_NAME		"sun6i_hwspinlock_test"
 
@@ -22,6 +32,9 @@
 #define MAX_LOCKS		256
 #define ATTEMPTS		3
 #define MAX_ATTEMPTS		10
+#define SPEEDUP			100
+#define MAX_SPEEDUP		100000
+#define REPLAY_TIMEOUT		10 /* ms */
 
 static int start_lock = START_LOCK;
 module_param(start_lock, int, 0444);
@@ -35,6 +48,36 @@ MODULE_PARM_DESC(attempts, "lock/unlock attempts per hwlock (default: 3 (1..10))
 static int holdtime;
 module_param(holdtime, int, 0444);
 MODULE_PARM_DESC(holdtime, "time period to hold a lock in us (default: 0 (0..1000000))");
+static char *replay;
+module_param(replay, charp, 0444);
+MODULE_PARM_DESC(replay, "firmware file with a recording to replay instead of the test");
+static int replay_cpus = 1;
+module_param(replay_cpus, int, 0444);
+MODULE_PARM_DESC(replay_cpus, "amount of cpus to replay the recording on (default: 1)");
+static int speedup = SPEEDUP;
+module_param(speedup, int, 0444);
+MODULE_PARM_DESC(speedup, "replay speed in percent (default: 100 (1..100000))");
+
+struct sun6i_hwspinlock_test_replay {
+	const struct sun6i_hwspinlock_replay_record *recs;
+	struct hwspinlock *hwlocks[MAX_LOCKS];
+	struct completion done;
+	atomic_t running;
+	u32 count;
+	int nworkers;
+	u64 start;
+};
+
+struct sun6i_hwspinlock_test_worker {
+	struct sun6i_hwspinlock_test_replay *replay;
+	int index;
+	u64 acquired;
+	u64 failed;
+	u64 skipped;
+	u64 wait_ns;
+	u64 wait_max_ns;
+	u64 late_ns;
+};
 
 static int sun6i_hwspinlock_test_lock(struct hwspinlock *hwlock)
 {
@@ -100,11 +143,225 @@ static int sun6i_hwspinlock_test_run(void)
 	return err;
 }
 
+static u64 sun6i_hwspinlock_test_scale(u32 ns)
+{
+	return div_u64((u64)ns * SPEEDUP, speedup);
+}
+
+static void sun6i_hwspinlock_test_delay(u64 ns)
+{
+	if (ns >= NSEC_PER_MSEC)
+		mdelay(div_u64(ns, NSEC_PER_MSEC));
+	else if (ns >= NSEC_PER_USEC)
+		udelay(div_u64(ns, NSEC_PER_USEC));
+	else
+		ndelay(ns);
+}
+
+/* sleep for the bigger part of the gap and spin for the rest to keep the timing accurate */
+static void sun6i_hwspinlock_test_wait_until(u64 deadline)
+{
+	u64 now = ktime_get_ns();
+
+	if (deadline > now + 100 * NSEC_PER_USEC)
+		usleep_range(div_u64(deadline - now, NSEC_PER_USEC) - 60,
+			     div_u64(deadline - now, NSEC_PER_USEC) - 50);
+
+	while (ktime_get_ns() < deadline)
+		cpu_relax();
+}
+
+static int sun6i_hwspinlock_test_replay_worker(void *data)
+{
+	struct sun6i_hwspinlock_test_worker *worker = data;
+	struct sun6i_hwspinlock_test_replay *replay = worker->replay;
+	const struct sun6i_hwspinlock_replay_record *rec;
+	struct hwspinlock *hwlock;
+	u64 at = 0, begin, wait;
+	u32 i;
+	int err;
+
+	/* every worker walks the whole recording to keep the arrival times in sync */
+	for (i = 0; i < replay->count; ++i) {
+		rec = &replay->recs[i];
+		at += sun6i_hwspinlock_test_scale(rec->gap_ns);
+		if (rec->cpu % replay->nworkers != worker->index)
+			continue;
+
+		hwlock = replay->hwlocks[rec->lock];
+		if (!hwlock) {
+			++worker->skipped;
+			continue;
+		}
+
+		sun6i_hwspinlock_test_wait_until(replay->start + at);
+		begin = ktime_get_ns();
+		worker->late_ns += begin - (replay->start + at);
+
+		err = hwspin_lock_timeout(hwlock, REPLAY_TIMEOUT);
+		wait = ktime_get_ns() - begin;
+		if (err) {
+			++worker->failed;
+			continue;
+		}
+
+		sun6i_hwspinlock_test_delay(sun6i_hwspinlock_test_scale(rec->hold_ns));
+		hwspin_unlock(hwlock);
+
+		++worker->acquired;
+		worker->wait_ns += wait;
+		worker->wait_max_ns = max(worker->wait_max_ns, wait);
+	}
+
+	if (atomic_dec_and_test(&replay->running))
+		complete(&replay->done);
+
+	return 0;
+}
+
+static int sun6i_hwspinlock_test_replay_run(const struct firmware *fw)
+{
+	const struct sun6i_hwspinlock_replay_header *hdr = (const void *)fw->data;
+	struct sun6i_hwspinlock_test_worker *workers;
+	struct sun6i_hwspinlock_test_replay *priv;
+	struct sun6i_hwspinlock_test_worker *w;
+	DECLARE_BITMAP(tried, MAX_LOCKS);
+	struct task_struct *task;
+	int i, cpu, err = 0;
+
+	if (fw->size < sizeof(*hdr) || hdr->magic != SUN6I_HWSPINLOCK_REPLAY_MAGIC ||
+	    hdr->version != SUN6I_HWSPINLOCK_REPLAY_VERSION ||
+	    fw->size < sizeof(*hdr) + array_size(hdr->count, sizeof(*priv->recs))) {
+		pr_info("[rply] invalid recording\n");
+		return -EINVAL;
+	}
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	priv->recs = (const void *)(hdr + 1);
+	priv->count = hdr->count;
+	priv->nworkers = clamp_t(int, replay_cpus, 1, num_online_cpus());
+	init_completion(&priv->done);
+	atomic_set(&priv->running, priv->nworkers);
+
+	workers = kcalloc(priv->nworkers, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		kfree(priv);
+		return -ENOMEM;
+	}
+
+	/* locks already used by other consumers can not be requested, their records are skipped */
+	bitmap_zero(tried, MAX_LOCKS);
+	for (i = 0; i < priv->count; ++i) {
+		if (__test_and_set_bit(priv->recs[i].lock, tried))
+			continue;
+
+		priv->hwlocks[priv->recs[i].lock] = hwspin_lock_request_specific(priv->recs[i].lock);
+		if (!priv->hwlocks[priv->recs[i].lock])
+			pr_info("[rply] requesting specific lock %d failed\n", priv->recs[i].lock);
+	}
+
+	pr_info("[rply]--- replaying %u records on %d cpus at %d%% ---\n", priv->count,
+		priv->nworkers, speedup);
+	priv->start = ktime_get_ns() + NSEC_PER_MSEC;
+
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == priv->nworkers)
+			break;
+
+		w = &workers[i];
+		w->replay = priv;
+		w->index = i;
+		task = kthread_create(sun6i_hwspinlock_test_replay_worker, w, "hwlock_replay/%d",
+				      cpu);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		++i;
+	}
+
+	/* account workers which could not be started */
+	for (; i < priv->nworkers; ++i) {
+		if (atomic_dec_and_test(&priv->running))
+			complete(&priv->done);
+	}
+
+	wait_for_completion(&priv->done);
+
+	for (i = 0; i < priv->nworkers; ++i) {
+		w = &workers[i];
+		pr_info("[rply] worker %d: %llu acquired, %llu failed, %llu skipped, wait avg %llu ns max %llu ns, late avg %llu ns\n",
+			i, w->acquired, w->failed, w->skipped,
+			w->acquired ? div64_u64(w->wait_ns, w->acquired) : 0, w->wait_max_ns,
+			(w->acquired + w->failed) ?
+			div64_u64(w->late_ns, w->acquired + w->failed) : 0);
+		if (w->failed)
+			err = -ETIMEDOUT;
+	}
+
+	for (i = 0; i < MAX_LOCKS; ++i) {
+		if (priv->hwlocks[i])
+			hwspin_lock_free(priv->hwlocks[i]);
+	}
+
+	kfree(workers);
+	kfree(priv);
+
+	return err;
+}
+
+static int sun6i_hwspinlock_test_replay(void)
+{
+	const struct firmware *fw;
+	struct device *dev;
+	int err;
+
+	if (speedup < 1 || speedup > MAX_SPEEDUP)
+		speedup = SPEEDUP;
+
+	dev = root_device_register(DRIVER_NAME);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+
+	err = request_firmware(&fw, replay, dev);
+	if (err) {
+		pr_info("[rply] loading recording %s failed (%d)\n", replay, err);
+		goto out;
+	}
+
+	err = sun6i_hwspinlock_test_replay_run(fw);
+	release_firmware(fw);
+
+out:
+	root_device_unregister(dev);
+
+	return err;
+}
+
 static const struct of_device_id sun6i_hwspinlock_test_ids[] = {
 	{ .compatible = "allwinner,sun6i-a31-hwspinlock", },
 	{},
 };
 
+/* the emulated devices have no device tree node, but are named like their drivers */
+static bool sun6i_hwspinlock_test_emulated(void)
+{
+	struct device *dev;
+
+	dev = bus_find_device_by_name(&platform_bus_type, NULL, "sun6i_hwspinlock");
+	if (!dev)
+		dev = bus_find_device_by_name(&platform_bus_type, NULL, "sun6i_hwspinlock_mod");
+	put_device(dev);
+
+	return dev;
+}
+
 static int __init sun6i_hwspinlock_test_init(void)
 {
 	struct device_node *np;
@@ -112,7 +369,7 @@ static int __init sun6i_hwspinlock_test_init(void)
 	pr_info("[init]--- SUN6I HWSPINLOCK DRIVER TEST ---\n");
 
 	np = of_find_matching_node_and_match(NULL, sun6i_hwspinlock_test_ids, NULL);
-	if (!np || !of_device_is_available(np)) {
+	if ((!np || !of_device_is_available(np)) && !sun6i_hwspinlock_test_emulated()) {
 		pr_info("[init] no known hwspinlock node found\n");
 		return -ENODEV;
 	}
@@ -125,6 +382,9 @@ static int __init sun6i_hwspinlock_test_init(void)
 	else
 		max_locks = max_locks - start_lock;
 
+	if (replay)
+		return sun6i_hwspinlock_test_replay();
+
 	return sun6i_hwspinlock_test_run();
 }
 module_init(sun6i_hwspinlock_test_init);
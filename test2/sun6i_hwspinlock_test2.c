@@ -17,9 +17,12 @@
 #include <linux/slab.h>
 #include <linux/types.h>
 
+#include "../sun6i_hwspinlock_emu.h"
+
 #define DRIVER_NAME		"sun6i_hwspinlock_test2"
 
 #define SPINLOCK_BASE_ID	0
+#define SPINLOCK_STATUS_REG	0x0010 /* only used by the emulated device */
 #define BITSTR_LEN		36
 
 #define START_LOCK		0
@@ -218,13 +221,18 @@ static int sun6i_hwspinlock_test2_run(struct sun6i_hwspinlock_test2_data *priv)
 
 static int sun6i_hwspinlock_test2_probe(struct platform_device *pdev)
 {
+	const struct sun6i_hwspinlock_emu *emu = dev_get_platdata(&pdev->dev);
 	struct sun6i_hwspinlock_test2_data *priv;
 
 	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
 
-	priv->io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
+	/* the status register of the emulated device is part of its register page */
+	if (emu)
+		priv->io_base = emu->base + SPINLOCK_STATUS_REG;
+	else
+		priv->io_base = devm_platform_ioremap_resource(pdev, SPINLOCK_BASE_ID);
 	if (IS_ERR(priv->io_base))
 		return PTR_ERR(priv->io_base);
 
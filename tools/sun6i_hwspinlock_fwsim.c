@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sun6i_hwspinlock_fwsim.c - userspace companion core firmware stand-in for sun6i hwspinlocks
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * Takes and releases hwspinlocks through /dev/mem like the companion core firmware would do and
+ * logs every event into the shared firmware trace ring, so the Linux side timeline can be
+ * tested without a modified firmware.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../sun6i_hwspinlock_trace.h"
+
+#define SPINLOCK_BASE		0x01c18000
+#define SPINLOCK_LOCK_REGN	0x0100
+#define SPINLOCK_NOTTAKEN	0
+#define MAP_LEN			0x1000
+
+static uint64_t counter(void)
+{
+	uint64_t val;
+
+#if defined(__aarch64__)
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r" (val) :: "memory");
+#elif defined(__arm__)
+	asm volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r" (val) :: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+	val = __rdtsc();
+#else
+	val = 0;
+#endif
+
+	return val;
+}
+
+static uint32_t counter_rate(void)
+{
+	uint32_t val = 0;
+
+#if defined(__aarch64__)
+	uint64_t tmp;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (tmp));
+	val = tmp;
+#elif defined(__arm__)
+	asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (val));
+#endif
+
+	return val;
+}
+
+static void trace(struct sun6i_hwspinlock_trace_ring *ring, int lock, int event)
+{
+	struct sun6i_hwspinlock_trace_entry *entry;
+	uint32_t head;
+
+	if (!ring)
+		return;
+
+	head = ring->head;
+	entry = &ring->entries[head & (ring->size - 1)];
+	entry->stamp = counter();
+	entry->lock = lock;
+	entry->event = event;
+	entry->side = SUN6I_HWSPINLOCK_TRACE_FIRMWARE;
+	entry->cpu = 0;
+	entry->reserved = 0;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *map(int fd, unsigned long addr, size_t len)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long offset = addr & (pagesize - 1);
+	char *ptr;
+
+	ptr = mmap(NULL, len + offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, addr - offset);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	return ptr + offset;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-b base] [-r ring] [-s ringlen] [-l lock] [-n loops] [-t holdtime]\n"
+		"  -b  physical hwspinlock base address (default: 0x%x)\n"
+		"  -r  physical address of the firmware trace ring (default: no tracing)\n"
+		"  -s  length of the firmware trace ring in bytes (default: 0x%x)\n"
+		"  -l  hwlock to take (default: 0)\n"
+		"  -n  amount of take/release loops (default: 1000)\n"
+		"  -t  time period to hold the lock in us (default: 100)\n",
+		name, SPINLOCK_BASE, MAP_LEN);
+}
+
+int main(int argc, char **argv)
+{
+	struct sun6i_hwspinlock_trace_ring *ring = NULL;
+	unsigned long base = SPINLOCK_BASE, ring_addr = 0, ring_len = MAP_LEN;
+	int lock = 0, loops = 1000, holdtime = 100;
+	volatile uint32_t *reg;
+	char *io_base;
+	int fd, opt, i, spinning;
+
+	while ((opt = getopt(argc, argv, "b:r:s:l:n:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			base = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ring_addr = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			ring_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			lock = atoi(optarg);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 't':
+			holdtime = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (lock < 0 || lock > 255 || ring_len < sizeof(*ring) + sizeof(ring->entries[0])) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		fprintf(stderr, "unable to open /dev/mem (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	io_base = map(fd, base, MAP_LEN);
+	if (!io_base) {
+		fprintf(stderr, "unable to map hwspinlock registers (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	reg = (volatile uint32_t *)(io_base + SPINLOCK_LOCK_REGN + sizeof(uint32_t) * lock);
+
+	if (ring_addr) {
+		ring = map(fd, ring_addr, ring_len);
+		if (!ring) {
+			fprintf(stderr, "unable to map trace ring (%s)\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		/* a reader must not see a valid magic on a half initialised ring */
+		__atomic_store_n(&ring->magic, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		/* the ring size has to be a power of two */
+		ring->size = 1;
+		while (sizeof(*ring) + sizeof(ring->entries[0]) * ring->size * 2 <= ring_len)
+			ring->size *= 2;
+		ring->version = SUN6I_HWSPINLOCK_TRACE_VERSION;
+		ring->rate = counter_rate();
+		ring->head = 0;
+		__atomic_store_n(&ring->magic, SUN6I_HWSPINLOCK_TRACE_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	for (i = 0; i < loops; ++i) {
+		spinning = 0;
+		while (*reg != SPINLOCK_NOTTAKEN) {
+			if (!spinning)
+				trace(ring, lock, SUN6I_HWSPINLOCK_TRACE_SPIN);
+			spinning = 1;
+		}
+		trace(ring, lock, SUN6I_HWSPINLOCK_TRACE_TAKEN);
+
+		usleep(holdtime);
+
+		trace(ring, lock, SUN6I_HWSPINLOCK_TRACE_RELEASED);
+		*reg = SPINLOCK_NOTTAKEN;
+		usleep(holdtime);
+	}
+
+	printf("%d take/release loops on lock %d done\n", loops, lock);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sun6i_hwspinlock_replay.c - userspace replay of recorded sun6i hwspinlock traffic
+ * Copyright (C) 2020 Wilken Gottwalt <wilken.gottwalt@posteo.net>
+ *
+ * Replays a recording taken from /sys/kernel/debug/sun6i_hwspinlock/recording through
+ * /dev/mem across several cpus, or dumps it as text.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../sun6i_hwspinlock_replay.h"
+
+#define SPINLOCK_BASE		0x01c18000
+#define SPINLOCK_LOCK_REGN	0x0100
+#define SPINLOCK_NOTTAKEN	0
+#define MAP_LEN			0x1000
+#define SPEEDUP			100
+#define TIMEOUT_NS		10000000ULL
+
+struct replay {
+	const struct sun6i_hwspinlock_replay_record *recs;
+	volatile uint32_t *regs;
+	uint32_t count;
+	int nworkers;
+	int speedup;
+	uint64_t start;
+};
+
+struct worker {
+	struct replay *replay;
+	pthread_t thread;
+	int index;
+	uint64_t acquired;
+	uint64_t failed;
+	uint64_t wait_ns;
+	uint64_t wait_max_ns;
+	uint64_t late_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void wait_until(uint64_t deadline)
+{
+	uint64_t now = now_ns();
+	struct timespec ts;
+
+	/* sleep for the bigger part of the gap and spin for the rest */
+	if (deadline > now + 100000) {
+		ts.tv_sec = (deadline - now - 50000) / 1000000000ULL;
+		ts.tv_nsec = (deadline - now - 50000) % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+
+	while (now_ns() < deadline)
+		;
+}
+
+static void *worker_fn(void *data)
+{
+	struct worker *w = data;
+	struct replay *r = w->replay;
+	const struct sun6i_hwspinlock_replay_record *rec;
+	volatile uint32_t *reg;
+	uint64_t at = 0, begin, wait;
+	uint32_t i;
+	int taken;
+
+	for (i = 0; i < r->count; ++i) {
+		rec = &r->recs[i];
+		at += (uint64_t)rec->gap_ns * SPEEDUP / r->speedup;
+		if (rec->cpu % r->nworkers != w->index)
+			continue;
+
+		wait_until(r->start + at);
+		begin = now_ns();
+		w->late_ns += begin - (r->start + at);
+
+		reg = &r->regs[rec->lock];
+		while (!(taken = (*reg == SPINLOCK_NOTTAKEN)) && now_ns() - begin < TIMEOUT_NS)
+			;
+		wait = now_ns() - begin;
+		if (!taken) {
+			++w->failed;
+			continue;
+		}
+
+		begin = now_ns();
+		while (now_ns() - begin < (uint64_t)rec->hold_ns * SPEEDUP / r->speedup)
+			;
+		*reg = SPINLOCK_NOTTAKEN;
+
+		++w->acquired;
+		w->wait_ns += wait;
+		if (wait > w->wait_max_ns)
+			w->wait_max_ns = wait;
+	}
+
+	return NULL;
+}
+
+static void dump(const struct sun6i_hwspinlock_replay_header *hdr,
+		 const struct sun6i_hwspinlock_replay_record *recs)
+{
+	uint32_t i;
+
+	printf("# gap_ns hold_ns lock cpu\n");
+	for (i = 0; i < hdr->count; ++i)
+		printf("%u %u %u %u\n", recs[i].gap_ns, recs[i].hold_ns, recs[i].lock, recs[i].cpu);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d] [-b base] [-c cpus] [-s speedup] recording\n"
+		"  -d  dump the recording as text instead of replaying it\n"
+		"  -b  physical hwspinlock base address (default: 0x%x)\n"
+		"  -c  amount of cpus to replay the recording on (default: 1)\n"
+		"  -s  replay speed in percent (default: %d)\n",
+		name, SPINLOCK_BASE, SPEEDUP);
+}
+
+int main(int argc, char **argv)
+{
+	struct sun6i_hwspinlock_replay_header hdr;
+	struct sun6i_hwspinlock_replay_record *recs;
+	struct replay replay = { .nworkers = 1, .speedup = SPEEDUP };
+	unsigned long base = SPINLOCK_BASE;
+	struct worker *workers;
+	cpu_set_t cpus;
+	FILE *file;
+	char *io_base;
+	int opt, fd, i, dump_only = 0, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "db:c:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dump_only = 1;
+			break;
+		case 'b':
+			base = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			replay.nworkers = atoi(optarg);
+			break;
+		case 's':
+			replay.speedup = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || replay.nworkers < 1 || replay.speedup < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	file = fopen(argv[optind], "rb");
+	if (!file) {
+		fprintf(stderr, "unable to open %s (%s)\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != SUN6I_HWSPINLOCK_REPLAY_MAGIC ||
+	    hdr.version != SUN6I_HWSPINLOCK_REPLAY_VERSION) {
+		fprintf(stderr, "invalid recording %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	recs = calloc(hdr.count ? hdr.count : 1, sizeof(*recs));
+	if (!recs || fread(recs, sizeof(*recs), hdr.count, file) != hdr.count) {
+		fprintf(stderr, "truncated recording %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	fclose(file);
+
+	if (dump_only) {
+		dump(&hdr, recs);
+		return EXIT_SUCCESS;
+	}
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		fprintf(stderr, "unable to open /dev/mem (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	io_base = mmap(NULL, MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+	if (io_base == MAP_FAILED) {
+		fprintf(stderr, "unable to map hwspinlock registers (%s)\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	workers = calloc(replay.nworkers, sizeof(*workers));
+	if (!workers)
+		return EXIT_FAILURE;
+
+	replay.recs = recs;
+	replay.count = hdr.count;
+	replay.regs = (volatile uint32_t *)(io_base + SPINLOCK_LOCK_REGN);
+	replay.start = now_ns() + 1000000;
+
+	printf("replaying %u records on %d cpus at %d%%\n", replay.count, replay.nworkers,
+	       replay.speedup);
+	for (i = 0; i < replay.nworkers; ++i) {
+		workers[i].replay = &replay;
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i])) {
+			fprintf(stderr, "unable to start worker %d\n", i);
+			return EXIT_FAILURE;
+		}
+
+		CPU_ZERO(&cpus);
+		CPU_SET(i, &cpus);
+		pthread_setaffinity_np(workers[i].thread, sizeof(cpus), &cpus);
+	}
+
+	for (i = 0; i < replay.nworkers; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		printf("worker %d: %llu acquired, %llu failed, wait avg %llu ns max %llu ns, late avg %llu ns\n",
+		       i, (unsigned long long)workers[i].acquired,
+		       (unsigned long long)workers[i].failed,
+		       (unsigned long long)(workers[i].acquired ?
+					    workers[i].wait_ns / workers[i].acquired : 0),
+		       (unsigned long long)workers[i].wait_max_ns,
+		       (unsigned long long)((workers[i].acquired + workers[i].failed) ?
+					    workers[i].late_ns /
+					    (workers[i].acquired + workers[i].failed) : 0));
+		if (workers[i].failed)
+			ret = EXIT_FAILURE;
+	}
+
+	munmap(io_base, MAP_LEN);
+	close(fd);
+	free(workers);
+	free(recs);
+
+	return ret;
+}